@@ -11,7 +11,13 @@ start()
 		case "$file" in
 			*-opkg) continue;;
 		esac
-		ipset restore < $file
+		# Sized for the entries and loaded in large batches if we can,
+		#  exit status 3 means loaded with some invalid lines skipped
+		if [ -x /usr/sbin/ipset-load ]; then
+			ipset-load $file || [ $? = 3 ] || ipset restore -exist < $file
+		else
+			ipset restore < $file
+		fi
 	done
 }
 
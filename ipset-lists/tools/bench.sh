@@ -0,0 +1,88 @@
+#!/bin/bash -e
+
+#
+# Benchmark of the route tools on synthetic lists shaped after the bundled
+#  IPIP.net list, which also checks that every aggregation engine gives the
+#  same minimal CIDR list.
+# Usage: ./bench.sh [entries ...]   (default: 1000 10000 100000 1000000)
+# Environment: KINDS (kinds of lists, see 'route-bench'), SEED
+#
+
+SEED_LIST=china.ipip-20250304
+KINDS=${KINDS:-"random real overlap adjacent dense"}
+SEED=${SEED:-1}
+SIZES=${*:-"1000 10000 100000 1000000"}
+
+BENCH=./ipv4-merger/route-bench
+MERGER=./ipv4-merger/ipv4-merger
+NETMASK=./netmask/netmask
+
+# Engine name and command, the input file is appended
+ENGINES=(
+	"merger        $MERGER -o cidr"
+	"merger-qsort  $MERGER -s qsort -o cidr"
+	"merger-radix  $MERGER -s radix -o cidr"
+	"merger-j4     $MERGER -j 4 -o cidr"
+	"merger-stream $MERGER -m 1 -o cidr"
+	"netmask       $NETMASK -n -c -f"
+)
+
+[ -x $BENCH -a -x $MERGER ] || make -C ipv4-merger >&2
+[ -x $NETMASK ] || make -C netmask >&2
+
+WORK=`mktemp -d ${TMPDIR:-/tmp}/route-bench.XXXXXX`
+trap 'rm -rf $WORK' EXIT
+
+# $1: stage, $2: entries, $3: ms, $4: KiB, $5: CIDRs, $6: check
+report() {
+	local rate=`awk -v n=$2 -v ms=$3 'BEGIN { printf("%.0f", ms > 0 ? n * 1000 / ms : 0) }'`
+	printf "%-8s %9s  %-14s %10s %12s %10s %9s  %s\n" $kind $2 $1 $3 $rate $4 "$5" "$6"
+}
+
+failed=0
+printf "%-8s %9s  %-14s %10s %12s %10s %9s  %s\n" \
+	kind entries stage ms entries/s peak-KiB cidrs check
+for size in $SIZES; do
+	for kind in $KINDS; do
+		in=$WORK/$kind-$size
+		stats=`$BENCH run -o $in $BENCH gen -k $kind -n $size -s $SEED -r $SEED_LIST`
+		read ms kib <<< "$stats"
+		report gen $size $ms $kib "" ""
+		# netmask writes ranges as 'a:b'
+		sed 's/-/:/' $in > $in.netmask
+
+		ref=
+		for engine in "${ENGINES[@]}"; do
+			set -- $engine
+			name=$1
+			shift
+			[ $name = netmask ] && file=$in.netmask || file=$in
+			if ! stats=`$BENCH run -o $WORK/out "$@" $file 2>$WORK/err`; then
+				cat $WORK/err >&2
+				report $name $size - - "" FAILED
+				failed=1
+				continue
+			fi
+			read ms kib <<< "$stats"
+			awk '{ print $1 }' $WORK/out > $WORK/$name.cidr
+			cidrs=`wc -l < $WORK/$name.cidr`
+			if [ -z "$ref" ]; then
+				ref=$WORK/$name.cidr
+				check=reference
+			elif cmp -s $ref $WORK/$name.cidr; then
+				check=ok
+			else
+				check=MISMATCH
+				failed=1
+				cp -f $in $in.netmask $ref $WORK/$name.cidr . 2>/dev/null || :
+			fi
+			report $name $size $ms $kib $cidrs $check
+		done
+		rm -f $in $in.netmask $WORK/*.cidr
+	done
+done
+
+if [ $failed != 0 ]; then
+	echo "*** Engines disagree or failed, see the inputs and outputs copied here." >&2
+	exit 1
+fi
@@ -0,0 +1,76 @@
+#!/bin/bash -e
+
+#
+# Check of 'dns-forwarder' against stub upstreams on loopback: the split by
+#  the domain list, answers over UDP and TCP (a truncated one retried over
+#  TCP), and the local server followed through a resolv.conf as it changes.
+# Usage: ./dns-check.sh
+# Environment: PORT (first of the ports used, default: 15300)
+#
+
+PORT=${PORT:-15300}
+
+FORWARDER=./domain-merger/dns-forwarder
+MERGER=./domain-merger/domain-merger
+STUB=./domain-merger/dns-stub
+
+[ -x $FORWARDER -a -x $MERGER -a -x $STUB ] || make -C domain-merger >&2
+
+WORK=`mktemp -d ${TMPDIR:-/tmp}/dns-check.XXXXXX`
+pids=
+trap 'kill $pids 2>/dev/null; rm -rf $WORK' EXIT
+
+printf 'banned.example\n' > $WORK/list
+$MERGER -o snapshot -t plain $WORK/list > $WORK/list.dsm
+
+# Trusted, local (truncating over UDP), and the next local servers
+$STUB serve 127.0.0.1 $((PORT + 1)) 10.0.0.1 & pids="$pids $!"
+$STUB serve -T 127.0.0.1 $((PORT + 2)) 10.0.0.2 & pids="$pids $!"
+if [ -f /proc/net/if_inet6 ]; then
+	next=::1
+else
+	next=127.0.0.1
+fi
+$STUB serve $next $((PORT + 3)) 10.0.0.3 & pids="$pids $!"
+
+echo "nameserver 127.0.0.1#$((PORT + 2))" > $WORK/resolv.conf
+$FORWARDER -f $WORK/list.dsm -s 127.0.0.1#$((PORT + 1)) -r $WORK/resolv.conf \
+	-l 127.0.0.1#$PORT 2>$WORK/err & pids="$pids $!"
+
+failed=0
+# $1: what, $2: expected answer, $@: query options and name
+check() {
+	local what="$1" expect="$2" answer
+	shift 2
+	answer=`$STUB query "$@" 2>&1 | tr '\n' ' '`
+	if [ "$answer" = "$expect " ]; then
+		echo "ok       $what"
+	else
+		echo "FAILED   $what: '$answer', expected '$expect'"
+		failed=1
+	fi
+}
+
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	$STUB query 127.0.0.1 $PORT www.banned.example >/dev/null 2>&1 && break
+	sleep 0.2
+done
+
+check "listed name over UDP"      10.0.0.1  127.0.0.1 $PORT www.banned.example
+check "listed name over TCP"      10.0.0.1  -t 127.0.0.1 $PORT banned.example
+check "other name over UDP"       truncated 127.0.0.1 $PORT example.org
+check "other name over TCP"       10.0.0.2  -t 127.0.0.1 $PORT example.org
+
+# As on a reconnect, with the new server first
+printf 'nameserver %s#%s\nnameserver 127.0.0.1#%s\n' $next $((PORT + 3)) $((PORT + 2)) \
+	> $WORK/resolv.conf.new
+mv -f $WORK/resolv.conf.new $WORK/resolv.conf
+sleep 2
+check "new local server over UDP" 10.0.0.3  127.0.0.1 $PORT example.org
+check "new local server over TCP" 10.0.0.3  -t 127.0.0.1 $PORT example.org
+check "listed name unchanged"     10.0.0.1  127.0.0.1 $PORT www.banned.example
+
+if [ $failed != 0 ]; then
+	cat $WORK/err >&2
+	exit 1
+fi
@@ -0,0 +1,785 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "dsmatch.h"
+#include "nlipset.h"
+
+/**
+ * DNS splitting forwarder: queries for the listed domains (and their
+ *  subdomains) go to the trusted upstream, the rest to the local one.
+ *  The IPv4 addresses answered for listed domains are added to an IP
+ *  set, a batch per event loop round. A TCP connection, as a client
+ *  retrying a truncated answer opens, is served by a child process of
+ *  its own the way dnsmasq does it.
+ */
+
+#define DNS_HEADER_SIZE   12
+#define DNS_MAX_PACKET    4096
+#define DNS_MAX_TCP       65535
+#define NR_IDS            65536
+#define MAX_TCP_CHILDREN  20
+
+enum { UP_LOCAL = 0, UP_TRUSTED, NR_UPSTREAMS };
+
+/* A query waiting for its answer, indexed by the ID sent upstream */
+struct pending {
+	struct sockaddr_in client;
+	uint64_t expires;         /* ms, 0 if free */
+	uint16_t client_id;
+	uint8_t  upstream;
+};
+
+static struct pending pendings[NR_IDS];
+static struct sockaddr_storage upstreams[NR_UPSTREAMS];
+static int upstream_fds[NR_UPSTREAMS] = { -1, -1 };
+static const char *resolv_path;   /* of the local upstream, with '-r' */
+static struct stat resolv_st;
+static unsigned nr_children;
+static struct dsmatch matcher;
+static const char *matcher_path;
+static struct nlipset nlset;
+static const char *set_name;
+static int verbose = 0;
+static unsigned query_timeout = 5000;
+
+static volatile sig_atomic_t got_sighup = 0, got_sigusr1 = 0, got_sigterm = 0;
+
+static struct {
+	unsigned long queries;
+	unsigned long answers;
+	unsigned long to_upstream[NR_UPSTREAMS];
+	unsigned long tcp;
+	unsigned long timeouts;
+	unsigned long dropped;
+	unsigned long set_entries;
+} stats;
+
+static void handle_signal(int sig)
+{
+	if (sig == SIGHUP)
+		got_sighup = 1;
+	else if (sig == SIGUSR1)
+		got_sigusr1 = 1;
+	else
+		got_sigterm = 1;
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t xorshift32(void)
+{
+	static uint32_t x = 0;
+	if (x == 0)
+		x = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16) ^ 2463534242U;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+/* "1.2.3.4", "1.2.3.4#5353", "1.2.3.4:5353", "::1" or "::1#5353" */
+static int parse_sockaddr(const char *s, struct sockaddr_storage *ss, int default_port)
+{
+	struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+	char host[INET6_ADDRSTRLEN];
+	const char *sep = strchr(s, '#');
+	size_t len;
+	long port = default_port;
+	char *end;
+
+	/* A single ':' is a port, more of them an IPv6 address */
+	if (!sep && (sep = strchr(s, ':')) && strchr(sep + 1, ':'))
+		sep = NULL;
+	len = sep ? (size_t)(sep - s) : strlen(s);
+	if (len >= sizeof(host))
+		return -EINVAL;
+	memcpy(host, s, len);
+	host[len] = '\0';
+	if (sep) {
+		port = strtol(sep + 1, &end, 10);
+		if (end == sep + 1 || *end || port <= 0 || port > 65535)
+			return -EINVAL;
+	}
+	memset(ss, 0, sizeof(*ss));
+	if (inet_pton(AF_INET, host, &sin->sin_addr) == 1) {
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+	} else if (inet_pton(AF_INET6, host, &sin6->sin6_addr) == 1) {
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+	} else {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static socklen_t sockaddr_len(const struct sockaddr_storage *ss)
+{
+	return ss->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+/* As "ip#port" */
+static const char *sockaddr_tos(const struct sockaddr_storage *ss, char *s, size_t size)
+{
+	const struct sockaddr_in *sin = (const struct sockaddr_in *)ss;
+	const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)ss;
+	char host[INET6_ADDRSTRLEN];
+
+	if (ss->ss_family == AF_INET6) {
+		inet_ntop(AF_INET6, &sin6->sin6_addr, host, sizeof(host));
+		snprintf(s, size, "%s#%u", host, ntohs(sin6->sin6_port));
+	} else {
+		inet_ntop(AF_INET, &sin->sin_addr, host, sizeof(host));
+		snprintf(s, size, "%s#%u", host, ntohs(sin->sin_port));
+	}
+	return s;
+}
+
+static int udp_socket(const struct sockaddr_storage *bind_to, const struct sockaddr_storage *peer)
+{
+	int fd, on = 1;
+
+	if ((fd = socket((bind_to ? bind_to : peer)->ss_family,
+			SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+		return -errno;
+	if (bind_to) {
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(fd, (const struct sockaddr *)bind_to, sockaddr_len(bind_to)) < 0)
+			goto fail;
+	}
+	/* Replies from anywhere else are filtered out by the kernel */
+	if (peer && connect(fd, (const struct sockaddr *)peer, sockaddr_len(peer)) < 0)
+		goto fail;
+	return fd;
+
+fail:
+	on = -errno;
+	close(fd);
+	return on;
+}
+
+static int tcp_listen_socket(const struct sockaddr_storage *bind_to)
+{
+	int fd, on = 1;
+
+	if ((fd = socket(bind_to->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+		return -errno;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(fd, (const struct sockaddr *)bind_to, sockaddr_len(bind_to)) < 0 ||
+		listen(fd, 16) < 0) {
+		on = -errno;
+		close(fd);
+		return on;
+	}
+	return fd;
+}
+
+/**
+ * The first usable "nameserver" of a resolv.conf, such as the one netifd
+ *  writes for the WAN. An "ip#port" is taken as well, for tests.
+ */
+static int read_resolv(const char *path, struct sockaddr_storage *ss)
+{
+	char line[256], addr[64];
+	FILE *fp;
+	int ret = -ENOENT;
+
+	if (!(fp = fopen(path, "r")))
+		return -errno;
+	while (ret < 0 && fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, " nameserver %63s", addr) == 1 && parse_sockaddr(addr, ss, 53) == 0)
+			ret = 0;
+	}
+	fclose(fp);
+	return ret;
+}
+
+/* Send the local queries to 'ss' from now on */
+static int set_local_upstream(int epfd, const struct sockaddr_storage *ss)
+{
+	struct epoll_event ev;
+	char s[INET6_ADDRSTRLEN + 8];
+	int fd;
+
+	if ((fd = udp_socket(NULL, ss)) < 0) {
+		fprintf(stderr, "*** Cannot reach %s: %s.\n", sockaddr_tos(ss, s, sizeof(s)),
+			strerror(-fd));
+		return fd;
+	}
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	/* Queries still out to the old one time out */
+	if (upstream_fds[UP_LOCAL] >= 0)
+		close(upstream_fds[UP_LOCAL]);
+	upstream_fds[UP_LOCAL] = fd;
+	upstreams[UP_LOCAL] = *ss;
+	return 0;
+}
+
+/**
+ * Follow the local server of 'resolv_path', which changes as the WAN
+ *  reconnects. The file is read again when it changed, or with 'force'.
+ */
+static void reload_resolv(int epfd, int force)
+{
+	struct sockaddr_storage ss;
+	struct stat st;
+	char s[INET6_ADDRSTRLEN + 8];
+
+	if (!resolv_path || stat(resolv_path, &st) < 0)
+		return;
+	if (!force && st.st_ino == resolv_st.st_ino && st.st_size == resolv_st.st_size &&
+		st.st_mtim.tv_sec == resolv_st.st_mtim.tv_sec &&
+		st.st_mtim.tv_nsec == resolv_st.st_mtim.tv_nsec)
+		return;
+	resolv_st = st;
+	/* None while the link is down, keep the last one */
+	if (read_resolv(resolv_path, &ss) < 0)
+		return;
+	if (upstream_fds[UP_LOCAL] >= 0 &&
+		memcmp(&ss, &upstreams[UP_LOCAL], sockaddr_len(&ss)) == 0)
+		return;
+	if (set_local_upstream(epfd, &ss) == 0)
+		fprintf(stderr, "Local server: %s\n", sockaddr_tos(&ss, s, sizeof(s)));
+}
+
+/**
+ * Skip a possibly compressed name at 'off', return the offset after it,
+ *  or -1 if malformed.
+ */
+static int dns_skip_name(const uint8_t *msg, size_t len, size_t off)
+{
+	while (off < len) {
+		uint8_t c = msg[off];
+		if (c == 0)
+			return off + 1;
+		if ((c & 0xc0) == 0xc0)
+			return off + 2 <= len ? (int)(off + 2) : -1;
+		if (c & 0xc0)
+			return -1;
+		off += 1 + c;
+	}
+	return -1;
+}
+
+/* Read the name of the first question as "a.b.c", return its length or -1 */
+static int dns_question_name(const uint8_t *msg, size_t len, char *name)
+{
+	size_t off = DNS_HEADER_SIZE, n = 0;
+
+	if (len < DNS_HEADER_SIZE || (msg[4] << 8 | msg[5]) == 0)
+		return -1;
+	while (off < len) {
+		uint8_t c = msg[off++];
+		size_t i;
+		if (c == 0)
+			return n;
+		/* No compression is expected in the question */
+		if ((c & 0xc0) || off + c > len || n + c + 1 > DSMATCH_MAX_NAME)
+			return -1;
+		if (n)
+			name[n++] = '.';
+		for (i = 0; i < c; i++) {
+			/* A dot inside a label could fake a suffix */
+			if (msg[off + i] == '.')
+				return -1;
+			name[n++] = msg[off + i];
+		}
+		off += c;
+	}
+	return -1;
+}
+
+/* Queue the A records of the answer section for the IP set */
+static void dns_collect_addrs(const uint8_t *msg, size_t len)
+{
+	unsigned qdcount = msg[4] << 8 | msg[5], ancount = msg[6] << 8 | msg[7], i;
+	int off = DNS_HEADER_SIZE;
+
+	for (i = 0; i < qdcount; i++) {
+		if ((off = dns_skip_name(msg, len, off)) < 0 || off + 4 > len)
+			return;
+		off += 4;
+	}
+	for (i = 0; i < ancount; i++) {
+		unsigned type, class, rdlength;
+		if ((off = dns_skip_name(msg, len, off)) < 0 || off + 10 > len)
+			return;
+		type = msg[off] << 8 | msg[off + 1];
+		class = msg[off + 2] << 8 | msg[off + 3];
+		rdlength = msg[off + 8] << 8 | msg[off + 9];
+		off += 10;
+		if (off + rdlength > len)
+			return;
+		if (type == 1 && class == 1 && rdlength == 4) {
+			uint32_t ip = (uint32_t)msg[off] << 24 | msg[off + 1] << 16 |
+				msg[off + 2] << 8 | msg[off + 3];
+			if (nlipset_add(&nlset, ip, 32) < 0)
+				stats.dropped++;
+			else
+				stats.set_entries++;
+		}
+		off += rdlength;
+	}
+}
+
+static void handle_query(int listen_fd, uint64_t now)
+{
+	uint8_t msg[DNS_MAX_PACKET];
+	char name[DSMATCH_MAX_NAME + 1];
+	struct sockaddr_in client;
+	socklen_t alen = sizeof(client);
+	ssize_t len;
+	int nlen, up, tries;
+	uint16_t id;
+
+	while ((len = recvfrom(listen_fd, msg, sizeof(msg), 0,
+			(struct sockaddr *)&client, &alen)) >= 0) {
+		alen = sizeof(client);
+		if (len < DNS_HEADER_SIZE || (msg[2] & 0x80)) {
+			stats.dropped++;
+			continue;
+		}
+		stats.queries++;
+
+		nlen = dns_question_name(msg, len, name);
+		up = nlen > 0 && dsmatch_lookup(&matcher, name, nlen) ? UP_TRUSTED : UP_LOCAL;
+		if (verbose) {
+			fprintf(stderr, "query %.*s -> %s\n", nlen > 0 ? nlen : 1,
+				nlen > 0 ? name : "?", up == UP_TRUSTED ? "trusted" : "local");
+		}
+		/* No local server in 'resolv_path' yet */
+		if (upstream_fds[up] < 0) {
+			stats.dropped++;
+			continue;
+		}
+
+		/* A random free ID, so that answers are hard to forge */
+		for (id = xorshift32(), tries = 0; pendings[id].expires && tries < NR_IDS;
+			 id++, tries++)
+			;
+		if (tries >= NR_IDS) {
+			stats.dropped++;
+			continue;
+		}
+		pendings[id].client = client;
+		pendings[id].client_id = msg[0] << 8 | msg[1];
+		pendings[id].upstream = up;
+		pendings[id].expires = now + query_timeout;
+		msg[0] = id >> 8;
+		msg[1] = id & 0xff;
+
+		if (send(upstream_fds[up], msg, len, 0) < 0) {
+			pendings[id].expires = 0;
+			stats.dropped++;
+			continue;
+		}
+		stats.to_upstream[up]++;
+	}
+}
+
+static void handle_answer(int listen_fd, int up)
+{
+	uint8_t msg[DNS_MAX_PACKET];
+	struct pending *p;
+	ssize_t len;
+
+	while ((len = recv(upstream_fds[up], msg, sizeof(msg), 0)) >= 0) {
+		if (len < DNS_HEADER_SIZE || !(msg[2] & 0x80)) {
+			stats.dropped++;
+			continue;
+		}
+		p = &pendings[msg[0] << 8 | msg[1]];
+		if (!p->expires || p->upstream != up) {
+			stats.dropped++;
+			continue;
+		}
+		if (up == UP_TRUSTED && set_name)
+			dns_collect_addrs(msg, len);
+
+		msg[0] = p->client_id >> 8;
+		msg[1] = p->client_id & 0xff;
+		sendto(listen_fd, msg, len, 0, (struct sockaddr *)&p->client, sizeof(p->client));
+		p->expires = 0;
+		stats.answers++;
+	}
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	uint8_t *p = buf;
+	ssize_t n;
+
+	while (len) {
+		if ((n = read(fd, p, len)) <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	ssize_t n;
+
+	while (len) {
+		if ((n = write(fd, p, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void set_timeouts(int fd)
+{
+	struct timeval tv = { query_timeout / 1000, query_timeout % 1000 * 1000 };
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* Ask upstream 'up' over TCP, return the length of the answer in 'msg' or -1 */
+static int tcp_exchange(int up, const uint8_t *query, size_t len, uint8_t *msg, size_t size)
+{
+	uint8_t hdr[2] = { len >> 8, len & 0xff };
+	int fd, n = -1;
+
+	if ((fd = socket(upstreams[up].ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+	set_timeouts(fd);
+	if (connect(fd, (const struct sockaddr *)&upstreams[up], sockaddr_len(&upstreams[up])) < 0 ||
+		write_full(fd, hdr, 2) < 0 || write_full(fd, query, len) < 0 ||
+		read_full(fd, hdr, 2) < 0)
+		goto out;
+	n = hdr[0] << 8 | hdr[1];
+	if ((size_t)n > size || read_full(fd, msg, n) < 0)
+		n = -1;
+out:
+	close(fd);
+	return n;
+}
+
+/* The queries of one TCP client, in a child process */
+static void serve_tcp(int fd)
+{
+	static uint8_t query[DNS_MAX_TCP], msg[DNS_MAX_TCP];
+	char name[DSMATCH_MAX_NAME + 1];
+	uint8_t hdr[2];
+	size_t len;
+	int nlen, up, n;
+
+	set_timeouts(fd);
+	/* The netlink socket of the parent would get our acks mixed up */
+	if (set_name) {
+		nlipset_close(&nlset);
+		if (nlipset_open(&nlset, set_name, 0) < 0)
+			set_name = NULL;
+	}
+	while (read_full(fd, hdr, 2) == 0) {
+		len = hdr[0] << 8 | hdr[1];
+		if (len < DNS_HEADER_SIZE || read_full(fd, query, len) < 0)
+			break;
+		nlen = dns_question_name(query, len, name);
+		up = nlen > 0 && dsmatch_lookup(&matcher, name, nlen) ? UP_TRUSTED : UP_LOCAL;
+		if (verbose) {
+			fprintf(stderr, "tcp query %.*s -> %s\n", nlen > 0 ? nlen : 1,
+				nlen > 0 ? name : "?", up == UP_TRUSTED ? "trusted" : "local");
+		}
+		if (upstream_fds[up] < 0 ||
+			(n = tcp_exchange(up, query, len, msg, sizeof(msg))) < DNS_HEADER_SIZE)
+			break;
+		if (up == UP_TRUSTED && set_name) {
+			dns_collect_addrs(msg, n);
+			nlipset_flush(&nlset);
+		}
+		hdr[0] = n >> 8;
+		hdr[1] = n & 0xff;
+		if (write_full(fd, hdr, 2) < 0 || write_full(fd, msg, n) < 0)
+			break;
+	}
+	close(fd);
+}
+
+static void handle_accept(int tcp_fd)
+{
+	pid_t pid;
+	int fd;
+
+	while ((fd = accept(tcp_fd, NULL, NULL)) >= 0) {
+		stats.tcp++;
+		if (nr_children >= MAX_TCP_CHILDREN || (pid = fork()) < 0) {
+			stats.dropped++;
+			close(fd);
+			continue;
+		}
+		if (pid == 0) {
+			signal(SIGTERM, SIG_DFL);
+			signal(SIGINT, SIG_DFL);
+			close(tcp_fd);
+			serve_tcp(fd);
+			_exit(0);
+		}
+		nr_children++;
+		close(fd);
+	}
+}
+
+static void expire_pendings(uint64_t now)
+{
+	size_t i;
+
+	for (i = 0; i < NR_IDS; i++) {
+		if (pendings[i].expires && pendings[i].expires <= now) {
+			pendings[i].expires = 0;
+			stats.timeouts++;
+		}
+	}
+}
+
+static int load_matcher(void)
+{
+	struct dsmatch m;
+	int ret;
+
+	if ((ret = dsmatch_open(&m, matcher_path)) < 0) {
+		fprintf(stderr, "*** Cannot load '%s': %s.\n", matcher_path, strerror(-ret));
+		return ret;
+	}
+	dsmatch_close(&matcher);
+	matcher = m;
+	return 0;
+}
+
+static void print_stats(void)
+{
+	fprintf(stderr, "%lu queries (%lu trusted, %lu local), %lu answers, %lu TCP connections, "
+			"%lu timeouts, %lu dropped, %lu set entries\n", stats.queries,
+			stats.to_upstream[UP_TRUSTED], stats.to_upstream[UP_LOCAL], stats.answers,
+			stats.tcp, stats.timeouts, stats.dropped, stats.set_entries);
+}
+
+static void print_help(int argc, char *argv[])
+{
+	printf("DNS forwarder that sends queries for listed domains to a trusted server.\n");
+	printf("Usage:\n");
+	printf("  %s -f <snapshot> -s <server> -u <server>|-r <file> [options]\n", argv[0]);
+	printf("Options:\n");
+	printf("  -f <snapshot>       domain list built by 'domain-merger -o snapshot'\n");
+	printf("  -s <ip[#port]>      trusted server, for listed domains and their subdomains\n");
+	printf("  -u <ip[#port]>      local server, for all other names\n");
+	printf("  -r <file>           local server: the first nameserver in <file>, such as\n");
+	printf("                      /tmp/resolv.conf.auto, followed as the file changes\n");
+	printf("  -l <ip[#port]>      address to listen on (default: 127.0.0.1#5353)\n");
+	printf("  -i <set>            add IPv4 addresses answered for listed domains to <set>\n");
+	printf("  -t <ms>             give up on an unanswered query after <ms> (default: 5000)\n");
+	printf("  -d                  run as a daemon\n");
+	printf("  -p <pidfile>        write the process ID to <pidfile>\n");
+	printf("  -v                  log every query to stderr\n");
+	printf("  -h                  print this help\n");
+	printf("Over UDP and TCP, a child process per TCP connection, %d at most.\n",
+		MAX_TCP_CHILDREN);
+	printf("SIGHUP reloads the snapshot and the '-r' file, SIGUSR1 prints the counters.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_storage listen_addr;
+	struct epoll_event ev, events[8];
+	const char *pid_file = NULL;
+	char s[INET6_ADDRSTRLEN + 8];
+	int has_upstream[NR_UPSTREAMS] = { 0, 0 };
+	int listen_fd, tcp_fd, epfd, daemonize = 0, opt, i;
+	uint64_t now, next_sweep;
+	struct sigaction sa;
+
+	parse_sockaddr("127.0.0.1", &listen_addr, 5353);
+
+	while ((opt = getopt(argc, argv, "f:s:u:r:l:i:t:dp:vh")) != -1) {
+		switch (opt) {
+		case 'f':
+			matcher_path = optarg;
+			break;
+		case 's':
+		case 'u':
+			i = opt == 's' ? UP_TRUSTED : UP_LOCAL;
+			if (parse_sockaddr(optarg, &upstreams[i], 53) < 0) {
+				fprintf(stderr, "*** Invalid server address '%s'.\n", optarg);
+				exit(1);
+			}
+			has_upstream[i] = 1;
+			break;
+		case 'r':
+			resolv_path = optarg;
+			break;
+		case 'l':
+			/* The pending queries keep IPv4 clients only */
+			if (parse_sockaddr(optarg, &listen_addr, 53) < 0 ||
+				listen_addr.ss_family != AF_INET) {
+				fprintf(stderr, "*** Invalid listening address '%s'.\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'i':
+			set_name = optarg;
+			break;
+		case 't':
+			query_timeout = strtoul(optarg, NULL, 10);
+			if (query_timeout == 0)
+				query_timeout = 5000;
+			break;
+		case 'd':
+			daemonize = 1;
+			break;
+		case 'p':
+			pid_file = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'h':
+			print_help(argc, argv);
+			exit(0);
+		default:
+			print_help(argc, argv);
+			exit(1);
+		}
+	}
+	if (!matcher_path || !has_upstream[UP_TRUSTED] ||
+		!has_upstream[UP_LOCAL] == !resolv_path) {
+		print_help(argc, argv);
+		exit(1);
+	}
+
+	if (load_matcher() < 0)
+		exit(1);
+	if (set_name && (i = nlipset_open(&nlset, set_name, 0)) < 0) {
+		fprintf(stderr, "*** Cannot open netlink for set '%s': %s.\n", set_name, strerror(-i));
+		exit(1);
+	}
+	if ((listen_fd = udp_socket(&listen_addr, NULL)) < 0 ||
+		(tcp_fd = tcp_listen_socket(&listen_addr)) < 0) {
+		fprintf(stderr, "*** Cannot listen on %s: %s.\n",
+			sockaddr_tos(&listen_addr, s, sizeof(s)), strerror(errno));
+		exit(1);
+	}
+	if ((upstream_fds[UP_TRUSTED] = udp_socket(NULL, &upstreams[UP_TRUSTED])) < 0) {
+		fprintf(stderr, "*** Cannot reach %s: %s.\n",
+			sockaddr_tos(&upstreams[UP_TRUSTED], s, sizeof(s)),
+			strerror(-upstream_fds[UP_TRUSTED]));
+		exit(1);
+	}
+
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		fprintf(stderr, "*** epoll_create1(): %s.\n", strerror(errno));
+		exit(1);
+	}
+	ev.events = EPOLLIN;
+	ev.data.fd = listen_fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+	ev.data.fd = tcp_fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, tcp_fd, &ev);
+	ev.data.fd = upstream_fds[UP_TRUSTED];
+	epoll_ctl(epfd, EPOLL_CTL_ADD, upstream_fds[UP_TRUSTED], &ev);
+	if (has_upstream[UP_LOCAL] && set_local_upstream(epfd, &upstreams[UP_LOCAL]) < 0)
+		exit(1);
+	/* Without a nameserver there yet, local names wait for one */
+	reload_resolv(epfd, 1);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	if (daemonize && daemon(0, 0) < 0) {
+		fprintf(stderr, "*** daemon(): %s.\n", strerror(errno));
+		exit(1);
+	}
+	if (pid_file) {
+		FILE *fp;
+		if ((fp = fopen(pid_file, "w"))) {
+			fprintf(fp, "%d\n", (int)getpid());
+			fclose(fp);
+		}
+	}
+
+	for (next_sweep = now_ms() + 1000; !got_sigterm; ) {
+		int nfds = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), 1000);
+
+		if (nfds < 0 && errno != EINTR) {
+			fprintf(stderr, "*** epoll_wait(): %s.\n", strerror(errno));
+			break;
+		}
+		now = now_ms();
+		for (i = 0; i < nfds; i++) {
+			int fd = events[i].data.fd;
+			if (fd == listen_fd)
+				handle_query(listen_fd, now);
+			else if (fd == tcp_fd)
+				handle_accept(tcp_fd);
+			else if (fd == upstream_fds[UP_TRUSTED])
+				handle_answer(listen_fd, UP_TRUSTED);
+			else if (fd == upstream_fds[UP_LOCAL])
+				handle_answer(listen_fd, UP_LOCAL);
+		}
+		/* All the addresses of this round in one netlink message */
+		if (set_name && nlset.nr_queued && (i = nlipset_flush(&nlset)) < 0)
+			fprintf(stderr, "*** Cannot add to set '%s': %s.\n", set_name, nlipset_strerror(i));
+
+		if (got_sighup) {
+			got_sighup = 0;
+			load_matcher();
+			reload_resolv(epfd, 1);
+		}
+		if (got_sigusr1) {
+			got_sigusr1 = 0;
+			print_stats();
+		}
+		if (now >= next_sweep) {
+			expire_pendings(now);
+			reload_resolv(epfd, 0);
+			next_sweep = now + 1000;
+		}
+		while (nr_children && waitpid(-1, NULL, WNOHANG) > 0)
+			nr_children--;
+	}
+
+	print_stats();
+	if (pid_file)
+		unlink(pid_file);
+	return 0;
+}
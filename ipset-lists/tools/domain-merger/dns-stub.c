@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/**
+ * Helper of 'dns-check.sh', a loopback stand-in for the upstream servers
+ *  of 'dns-forwarder':
+ *  serve - answer every A query with one fixed address, over UDP and TCP
+ *  query - ask a server for the A records of a name, and print them
+ */
+
+#define DNS_HEADER_SIZE   12
+#define DNS_MAX_TCP       65535
+
+static int resolve(const char *host, const char *port, int type, struct addrinfo **ai)
+{
+	struct addrinfo hints;
+	int ret;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = type;
+	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+	if ((ret = getaddrinfo(host, port, &hints, ai)) != 0) {
+		fprintf(stderr, "*** Invalid address '%s#%s': %s.\n", host, port, gai_strerror(ret));
+		return -1;
+	}
+	return 0;
+}
+
+static void set_timeouts(int fd)
+{
+	struct timeval tv = { 2, 0 };
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	uint8_t *p = buf;
+	ssize_t n;
+
+	while (len) {
+		if ((n = read(fd, p, len)) <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Skip a possibly compressed name at 'off', return the offset after it or -1 */
+static int skip_name(const uint8_t *msg, size_t len, size_t off)
+{
+	while (off < len) {
+		uint8_t c = msg[off];
+		if (c == 0)
+			return off + 1;
+		if ((c & 0xc0) == 0xc0)
+			return off + 2 <= len ? (int)(off + 2) : -1;
+		off += 1 + c;
+	}
+	return -1;
+}
+
+/* Build the answer to 'q' in 'a', with no record if 'truncate' */
+static int build_answer(const uint8_t *q, size_t len, uint8_t *a, struct in_addr addr,
+		int truncate)
+{
+	int off;
+
+	if (len < DNS_HEADER_SIZE || (q[2] & 0x80) ||
+		(off = skip_name(q, len, DNS_HEADER_SIZE)) < 0 || (size_t)off + 4 > len)
+		return -1;
+	memcpy(a, q, off + 4);
+	a[2] = 0x84 | (q[2] & 0x01) | (truncate ? 0x02 : 0);  /* QR, AA, TC, RD */
+	a[3] = 0x80;                                           /* RA */
+	memset(a + 4, 0, 8);
+	a[5] = 1;
+	off += 4;
+	/* A of class IN only */
+	if (truncate || q[off - 4] != 0 || q[off - 3] != 1 || q[off - 2] != 0 || q[off - 1] != 1)
+		return off;
+	a[7] = 1;
+	memcpy(a + off, "\xc0\x0c\x00\x01\x00\x01\x00\x00\x00\x3c\x00\x04", 12);
+	memcpy(a + off + 12, &addr, 4);
+	return off + 16;
+}
+
+static int do_serve(int argc, char *argv[])
+{
+	static uint8_t q[DNS_MAX_TCP], a[DNS_MAX_TCP + 16];
+	struct addrinfo *udp_ai, *tcp_ai;
+	struct pollfd fds[2];
+	struct in_addr addr;
+	int truncate = 0, on = 1, opt, n;
+
+	while ((opt = getopt(argc, argv, "T")) != -1) {
+		switch (opt) {
+		case 'T':
+			truncate = 1;
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (argc - optind != 3 || inet_pton(AF_INET, argv[optind + 2], &addr) != 1 ||
+		resolve(argv[optind], argv[optind + 1], SOCK_DGRAM, &udp_ai) < 0 ||
+		resolve(argv[optind], argv[optind + 1], SOCK_STREAM, &tcp_ai) < 0)
+		return 1;
+
+	fds[0].fd = socket(udp_ai->ai_family, SOCK_DGRAM, 0);
+	fds[1].fd = socket(tcp_ai->ai_family, SOCK_STREAM, 0);
+	setsockopt(fds[1].fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (fds[0].fd < 0 || fds[1].fd < 0 ||
+		bind(fds[0].fd, udp_ai->ai_addr, udp_ai->ai_addrlen) < 0 ||
+		bind(fds[1].fd, tcp_ai->ai_addr, tcp_ai->ai_addrlen) < 0 ||
+		listen(fds[1].fd, 4) < 0) {
+		fprintf(stderr, "*** Cannot listen on %s#%s: %s.\n", argv[optind],
+			argv[optind + 1], strerror(errno));
+		return 1;
+	}
+	fds[0].events = fds[1].events = POLLIN;
+
+	while (poll(fds, 2, -1) >= 0) {
+		if (fds[0].revents & POLLIN) {
+			struct sockaddr_storage from;
+			socklen_t alen = sizeof(from);
+			ssize_t len = recvfrom(fds[0].fd, q, sizeof(q), 0,
+				(struct sockaddr *)&from, &alen);
+			if (len > 0 && (n = build_answer(q, len, a, addr, truncate)) > 0)
+				sendto(fds[0].fd, a, n, 0, (struct sockaddr *)&from, alen);
+		}
+		if (fds[1].revents & POLLIN) {
+			uint8_t hdr[2];
+			int fd = accept(fds[1].fd, NULL, NULL);
+
+			if (fd < 0)
+				continue;
+			set_timeouts(fd);
+			/* Never truncated over TCP */
+			while (read_full(fd, hdr, 2) == 0 && read_full(fd, q, hdr[0] << 8 | hdr[1]) == 0 &&
+				(n = build_answer(q, hdr[0] << 8 | hdr[1], a + 2, addr, 0)) > 0) {
+				a[0] = n >> 8;
+				a[1] = n & 0xff;
+				if (write(fd, a, n + 2) != n + 2)
+					break;
+			}
+			close(fd);
+		}
+	}
+	return 1;
+}
+
+static int do_query(int argc, char *argv[])
+{
+	static uint8_t q[512], a[DNS_MAX_TCP];
+	struct addrinfo *ai;
+	const char *name, *dot;
+	int tcp = 0, fd, opt, qlen, off, i;
+	unsigned ancount;
+	ssize_t len;
+
+	while ((opt = getopt(argc, argv, "t")) != -1) {
+		switch (opt) {
+		case 't':
+			tcp = 1;
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (argc - optind != 3 || strlen(argv[optind + 2]) > 253 ||
+		resolve(argv[optind], argv[optind + 1], tcp ? SOCK_STREAM : SOCK_DGRAM, &ai) < 0)
+		return 1;
+
+	/* ID, RD, a question */
+	srand(time(NULL) ^ getpid());
+	memset(q, 0, DNS_HEADER_SIZE);
+	q[0] = rand() & 0xff;
+	q[1] = rand() & 0xff;
+	q[2] = 0x01;
+	q[5] = 1;
+	for (qlen = DNS_HEADER_SIZE, name = argv[optind + 2]; *name; name = *dot ? dot + 1 : dot) {
+		if (!(dot = strchr(name, '.')))
+			dot = name + strlen(name);
+		if (dot == name || dot - name > 63)
+			return 1;
+		q[qlen++] = dot - name;
+		memcpy(q + qlen, name, dot - name);
+		qlen += dot - name;
+	}
+	memcpy(q + qlen, "\x00\x00\x01\x00\x01", 5);
+	qlen += 5;
+
+	if ((fd = socket(ai->ai_family, tcp ? SOCK_STREAM : SOCK_DGRAM, 0)) < 0)
+		return 1;
+	set_timeouts(fd);
+	if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+		fprintf(stderr, "*** Cannot reach %s#%s: %s.\n", argv[optind], argv[optind + 1],
+			strerror(errno));
+		return 1;
+	}
+	if (tcp) {
+		uint8_t hdr[2] = { qlen >> 8, qlen & 0xff };
+		if (write(fd, hdr, 2) != 2 || write(fd, q, qlen) != qlen ||
+			read_full(fd, hdr, 2) < 0 || read_full(fd, a, hdr[0] << 8 | hdr[1]) < 0)
+			len = -1;
+		else
+			len = hdr[0] << 8 | hdr[1];
+	} else {
+		if (send(fd, q, qlen, 0) != qlen)
+			len = -1;
+		else
+			len = recv(fd, a, sizeof(a), 0);
+	}
+	if (len < DNS_HEADER_SIZE || a[0] != q[0] || a[1] != q[1]) {
+		fprintf(stderr, "*** No answer from %s#%s.\n", argv[optind], argv[optind + 1]);
+		return 1;
+	}
+
+	if (a[2] & 0x02)
+		printf("truncated\n");
+	ancount = a[6] << 8 | a[7];
+	if ((off = skip_name(a, len, DNS_HEADER_SIZE)) < 0)
+		return 1;
+	for (off += 4, i = 0; i < (int)ancount; i++) {
+		unsigned rdlength;
+		if ((off = skip_name(a, len, off)) < 0 || off + 10 > len)
+			return 1;
+		rdlength = a[off + 8] << 8 | a[off + 9];
+		if (off + 10 + rdlength > (size_t)len)
+			return 1;
+		if (a[off + 1] == 1 && rdlength == 4)
+			printf("%u.%u.%u.%u\n", a[off + 10], a[off + 11], a[off + 12], a[off + 13]);
+		off += 10 + rdlength;
+	}
+	return 0;
+}
+
+static void print_help(int argc, char *argv[])
+{
+	printf("Loopback DNS server and client for 'dns-check.sh'.\n");
+	printf("Usage:\n");
+	printf("  %s serve [-T] <ip> <port> <answer>\n", argv[0]);
+	printf("  %s query [-t] <ip> <port> <name>\n", argv[0]);
+	printf("serve: answer every A query with the IPv4 address <answer>,\n");
+	printf("  -T  truncate the answers over UDP, for the client to retry over TCP\n");
+	printf("query: print the A records answered for <name>, 'truncated' if so,\n");
+	printf("  -t  ask over TCP\n");
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc >= 2 && strcmp(argv[1], "serve") == 0)
+		return do_serve(argc - 1, argv + 1);
+	if (argc >= 2 && strcmp(argv[1], "query") == 0)
+		return do_query(argc - 1, argv + 1);
+	print_help(argc, argv);
+	return argc >= 2 && strcmp(argv[1], "-h") == 0 ? 0 : 1;
+}
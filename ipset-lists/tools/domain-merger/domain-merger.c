@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "dtrie.h"
+#include "dsmatch.h"
+
+enum input_format {
+	INPUT_PLAIN = 0,  /* one domain per line */
+	INPUT_GFWLIST,    /* decoded gfwlist.txt, Adblock Plus rules */
+};
+
+/**
+ * Reduce a gfwlist rule to a bare domain the way gfwlist.sh did with sed,
+ *  in place. Return the length, or 0 if the rule is not usable.
+ */
+static size_t gfwlist_rule_domain(char *s, size_t len)
+{
+	size_t i, j, n_dots = 0;
+	int is_ipv4 = 1;
+	char *p;
+
+	/* Comments, exceptions and sections */
+	if (len == 0 || s[0] == '!' || s[0] == '#' || (s[0] == '@' && s[1] == '@'))
+		return 0;
+	/* Anything after '!' */
+	if ((p = memchr(s, '!', len)) && p + 1 < s + len)
+		len = p - s;
+	/* Drop '|' and '@' */
+	for (i = j = 0; i < len; i++) {
+		if (s[i] != '|' && s[i] != '@')
+			s[j++] = s[i];
+	}
+	len = j;
+	s[len] = '\0';
+	/* The first "http://" or "https://" */
+	for (p = s; (p = strstr(p, "http")); p++) {
+		size_t n = p[4] == 's' ? 8 : 7;
+		if (strncmp(p + n - 3, "://", 3) == 0) {
+			memmove(p, p + n, len - (p - s) - n + 1);
+			len -= n;
+			break;
+		}
+	}
+	if (memchr(s, '*', len) || strstr(s, "apple.com"))
+		return 0;
+
+	for (i = 0; i < len; i++) {
+		if (s[i] == '.') {
+			n_dots++;
+			/* Digits on both sides, for an IPv4 address */
+			if (i == 0 || s[i - 1] == '.' || i == len - 1)
+				is_ipv4 = 0;
+		} else if (s[i] >= 'a' && s[i] <= 'z') {
+			is_ipv4 = 0;
+		} else if (s[i] == '-') {
+			is_ipv4 = 0;
+		} else if (!(s[i] >= '0' && s[i] <= '9')) {
+			return 0;
+		}
+	}
+	/* Bare IPv4 addresses and names without a dot */
+	if (n_dots == 0 || (is_ipv4 && n_dots == 3))
+		return 0;
+	for (i = 0; i < len && s[i] == '.'; i++)
+		;
+	memmove(s, s + i, len - i + 1);
+	return len - i;
+}
+
+static int load_file(struct dtrie *t, const char *path, enum input_format format)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int errors = 0, ret = 0;
+
+	if (strcmp(path, "-") == 0) {
+		fp = stdin;
+	} else if (!(fp = fopen(path, "r"))) {
+		fprintf(stderr, "Cannot open '%s': %s.\n", path, strerror(errno));
+		return -errno;
+	}
+
+	while ((len = getline(&line, &size, fp)) >= 0) {
+		char *s = line;
+		ssize_t i;
+
+		while (len > 0 && isspace((unsigned char)s[len - 1]))
+			s[--len] = '\0';
+		if (format == INPUT_GFWLIST) {
+			if ((len = gfwlist_rule_domain(s, len)) == 0)
+				continue;
+		} else {
+			while (len > 0 && isspace((unsigned char)*s))
+				s++, len--;
+			if (len == 0 || s[0] == '#')
+				continue;
+			for (i = 0; i < len; i++)
+				s[i] = tolower((unsigned char)s[i]);
+		}
+		if ((ret = dtrie_add(t, s, len)) == -ENOMEM)
+			break;
+		if (ret < 0 && errors++ < 10)
+			fprintf(stderr, "%s: invalid domain '%s'.\n", path, s);
+		ret = 0;
+	}
+	if (errors)
+		fprintf(stderr, "%s: %d invalid domains.\n", path, errors);
+
+	free(line);
+	if (fp != stdin)
+		fclose(fp);
+	return ret;
+}
+
+static void print_help(int argc, char *argv[])
+{
+	printf("Domain list compiler: keeps the least specific domains, which cover the rest.\n");
+	printf("Usage:\n");
+	printf("  %s [options] [[-t format] file ...]\n", argv[0]);
+	printf("Options:\n");
+	printf("  -t <format>         format of the files that follow: 'plain' (default), one\n");
+	printf("                      domain per line, or 'gfwlist' (decoded gfwlist.txt)\n");
+	printf("  -o <output>         output format: 'list' (default), or 'snapshot' (binary\n");
+	printf("                      matcher for 'dslookup' and 'dns-forwarder')\n");
+	printf("  -v                  print the counts to stderr\n");
+	printf("  -h, --help          print this help\n");
+	printf("Without any file, stdin is read. '-' stands for stdin as well.\n");
+	printf("Example:\n");
+	printf("  %s -t gfwlist gfwlist.txt -t plain base-banned.txt\n", argv[0]);
+}
+
+int main(int argc, char *argv[])
+{
+	enum input_format format = INPUT_PLAIN;
+	struct dtrie t;
+	uint32_t nr, i;
+	const char *path;
+	char **list;
+	int nr_files = 0, verbose = 0, snapshot = 0, opt, ret;
+	struct option longopts[] = {
+		{ "type", required_argument, NULL, 't', },
+		{ "output", required_argument, NULL, 'o', },
+		{ "verbose", no_argument, NULL, 'v', },
+		{ "help", no_argument, NULL, 'h', },
+		{ NULL, 0, NULL, 0, },
+	};
+
+	if (dtrie_init(&t) < 0) {
+		fprintf(stderr, "*** Out of memory.\n");
+		exit(1);
+	}
+
+	/* Options apply to the files following them, so stop at each file */
+	for (;;) {
+		while ((opt = getopt_long(argc, argv, "+t:o:vh", longopts, NULL)) != -1) {
+			switch (opt) {
+			case 't':
+				if (strcmp(optarg, "plain") == 0) {
+					format = INPUT_PLAIN;
+				} else if (strcmp(optarg, "gfwlist") == 0) {
+					format = INPUT_GFWLIST;
+				} else {
+					fprintf(stderr, "*** Unknown input format '%s'.\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'o':
+				if (strcmp(optarg, "list") == 0) {
+					snapshot = 0;
+				} else if (strcmp(optarg, "snapshot") == 0) {
+					snapshot = 1;
+				} else {
+					fprintf(stderr, "*** Unknown output format '%s'.\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			case 'h':
+				print_help(argc, argv);
+				exit(0);
+			default:
+				print_help(argc, argv);
+				exit(1);
+			}
+		}
+
+		if (optind < argc)
+			path = argv[optind++];
+		else if (nr_files == 0)
+			path = "-";
+		else
+			break;
+
+		if ((ret = load_file(&t, path, format)) < 0) {
+			if (ret == -ENOMEM)
+				fprintf(stderr, "*** Out of memory.\n");
+			exit(1);
+		}
+		nr_files++;
+	}
+
+	if (!(list = dtrie_collect(&t, &nr))) {
+		fprintf(stderr, "*** Out of memory.\n");
+		exit(1);
+	}
+	if (snapshot) {
+		if (isatty(STDOUT_FILENO)) {
+			fprintf(stderr, "*** Not writing a snapshot to a terminal.\n");
+			exit(1);
+		}
+		if ((ret = dsmatch_write(stdout, list, nr)) < 0) {
+			fprintf(stderr, "*** Failed to write the snapshot: %s.\n", strerror(-ret));
+			exit(1);
+		}
+	} else {
+		for (i = 0; i < nr; i++)
+			puts(list[i]);
+	}
+	if (verbose) {
+		fprintf(stderr, "%u domains read, %u covered, %u kept, %u trie nodes.\n",
+			t.nr_domains, t.nr_covered, nr, t.nr_nodes);
+	}
+
+	free(list);
+	dtrie_free(&t);
+	return 0;
+}
@@ -0,0 +1,293 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "dtrie.h"
+#include "dsmatch.h"
+
+/**
+ * Batch mode: classify the first word of each line of stdin, reading
+ *  in large blocks.
+ */
+static int lookup_stream(const struct dsmatch *m, int quiet)
+{
+	static char buf[1 << 20];
+	size_t len = 0, nr_names = 0, nr_hits = 0;
+	ssize_t rc;
+
+	for (;;) {
+		char *p, *end, *eol;
+
+		if ((rc = read(STDIN_FILENO, buf + len, sizeof(buf) - len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "*** Failed to read stdin: %s.\n", strerror(errno));
+			return -errno;
+		}
+		len += rc;
+
+		for (p = buf, end = buf + len; p < end; p = eol + 1) {
+			const char *w;
+			int found;
+
+			if (!(eol = memchr(p, '\n', end - p))) {
+				if (rc > 0)
+					break;
+				eol = end;  /* last line without '\n' */
+			}
+			while (p < eol && (*p == ' ' || *p == '\t'))
+				p++;
+			for (w = p; w < eol && *w != ' ' && *w != '\t' && *w != '\r'; w++)
+				;
+			if (w == p)
+				continue;
+			nr_names++;
+			found = dsmatch_lookup(m, p, w - p);
+			nr_hits += found;
+			if (!quiet) {
+				fwrite(p, 1, w - p, stdout);
+				fputs(found ? " yes\n" : " no\n", stdout);
+			}
+		}
+
+		if (rc == 0)
+			break;
+		len = end - p;
+		memmove(buf, p, len);
+		if (len == sizeof(buf)) {
+			fprintf(stderr, "*** Line too long on stdin.\n");
+			return -EINVAL;
+		}
+	}
+
+	fprintf(stderr, "%zu names, %zu matched\n", nr_names, nr_hits);
+	return nr_hits == nr_names ? 0 : 1;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_report(const char *name, size_t count, double t,
+		size_t nr_hits, size_t mem)
+{
+	printf("  %-20s %8.2f M/s %7.1f ns  %8zu KiB  (%zu hits)\n", name,
+			count / t / 1e6, t * 1e9 / count, (mem + 1023) / 1024, nr_hits);
+}
+
+/* What a plain text list gives: compare the query with every line */
+static int text_match(char * const *names, size_t nr, const char *q, size_t qlen)
+{
+	size_t i;
+
+	for (i = 0; i < nr; i++) {
+		size_t len = strlen(names[i]);
+		if (len <= qlen && memcmp(q + qlen - len, names[i], len) == 0 &&
+			(len == qlen || q[qlen - len - 1] == '.'))
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Benchmark the snapshot against the text list it was built from: a
+ *  linear scan of the lines, and a trie built in memory at start-up.
+ *  Half of the names are subdomains of listed ones.
+ */
+static int lookup_bench(const char *snapshot_path, const char *list_path, size_t count)
+{
+	struct dsmatch m;
+	struct dtrie trie;
+	FILE *fp;
+	char **names = NULL, *line = NULL, *qbuf;
+	size_t nr = 0, size = 0, text_mem = 0, i, n, nr_linear, mismatches = 0;
+	size_t *qoff;
+	uint8_t *ref, *hits;
+	uint32_t x = 2463534242U;
+	ssize_t len;
+	double t;
+	int ret;
+
+	/* Start-up costs first */
+	t = now_sec();
+	if ((ret = dsmatch_open(&m, snapshot_path)) < 0) {
+		fprintf(stderr, "*** Cannot load '%s': %s.\n", snapshot_path, strerror(-ret));
+		return ret;
+	}
+	t = now_sec() - t;
+	printf("snapshot opened in %.3f ms\n", t * 1e3);
+
+	t = now_sec();
+	if (!(fp = fopen(list_path, "r"))) {
+		fprintf(stderr, "*** Cannot open '%s': %s.\n", list_path, strerror(errno));
+		return -errno;
+	}
+	if (dtrie_init(&trie) < 0)
+		return -ENOMEM;
+	while ((len = getline(&line, &size, fp)) >= 0) {
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		if (len == 0 || line[0] == '#')
+			continue;
+		if (!(nr & (nr + 1)) && !(names = realloc(names, sizeof(char *) * (nr + 1) * 2)))
+			return -ENOMEM;
+		names[nr++] = strdup(line);
+		text_mem += len + 1;
+		dtrie_add(&trie, line, len);
+	}
+	free(line);
+	fclose(fp);
+	t = now_sec() - t;
+	printf("text list of %zu names loaded into a trie in %.3f ms\n", nr, t * 1e3);
+	if (nr == 0) {
+		fprintf(stderr, "*** Empty list.\n");
+		return -EINVAL;
+	}
+
+	qbuf = malloc(count * (DTRIE_MAX_NAME + 2));
+	qoff = malloc(sizeof(size_t) * (count + 1));
+	ref = malloc(count);
+	hits = malloc(count);
+	if (!qbuf || !qoff || !ref || !hits)
+		return -ENOMEM;
+	for (i = 0, qoff[0] = 0; i < count; i++) {
+		char *q = qbuf + qoff[i];
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		if (i & 1)
+			len = snprintf(q, DTRIE_MAX_NAME + 2, "w%u.%s", x % 1000, names[x % nr]);
+		else if (i & 2)
+			len = snprintf(q, DTRIE_MAX_NAME + 2, "%sx", names[x % nr]);
+		else
+			len = snprintf(q, DTRIE_MAX_NAME + 2, "n%u.example%u.net", x, x % 7);
+		if (len > DTRIE_MAX_NAME)
+			len = DTRIE_MAX_NAME;
+		qoff[i + 1] = qoff[i] + len + 1;
+	}
+
+	printf("%zu names, %zu lookups\n", nr, count);
+	printf("  %-20s %12s %10s %12s\n", "method", "throughput", "latency", "memory");
+
+	/* Far too slow for all of them */
+	nr_linear = count < 20000 ? count : 20000;
+	t = now_sec();
+	for (i = 0, n = 0; i < nr_linear; i++)
+		n += (ref[i] = text_match(names, nr, qbuf + qoff[i], qoff[i + 1] - qoff[i] - 1));
+	t = now_sec() - t;
+	bench_report("text list, linear", nr_linear, t, n, text_mem);
+
+	t = now_sec();
+	for (i = 0, n = 0; i < count; i++)
+		n += (hits[i] = dtrie_match(&trie, qbuf + qoff[i], qoff[i + 1] - qoff[i] - 1));
+	t = now_sec() - t;
+	mismatches += memcmp(ref, hits, nr_linear) != 0;
+	memcpy(ref, hits, count);
+	bench_report("trie from text", count, t, n, sizeof(struct dtrie_node) * trie.nodes_size +
+			sizeof(uint32_t) * trie.nr_buckets + trie.pool_size);
+
+	t = now_sec();
+	for (i = 0, n = 0; i < count; i++)
+		n += (hits[i] = dsmatch_lookup(&m, qbuf + qoff[i], qoff[i + 1] - qoff[i] - 1));
+	t = now_sec() - t;
+	mismatches += memcmp(ref, hits, count) != 0;
+	bench_report("snapshot", count, t, n, m.map_len);
+
+	for (i = 0; i < nr; i++)
+		free(names[i]);
+	free(names);
+	free(qbuf);
+	free(qoff);
+	free(ref);
+	free(hits);
+	dtrie_free(&trie);
+	dsmatch_close(&m);
+
+	if (mismatches) {
+		fprintf(stderr, "*** Lookup methods disagree!\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static void print_help(int argc, char *argv[])
+{
+	printf("Match domain names against a snapshot built by 'domain-merger -o snapshot'.\n");
+	printf("Usage:\n");
+	printf("  %s [options] <snapshot> <name> [name ...]\n", argv[0]);
+	printf("  %s -b [-q] <snapshot>        classify one name per line from stdin\n", argv[0]);
+	printf("  %s -B <snapshot> <list> [count]\n", argv[0]);
+	printf("                                      benchmark against the text list\n");
+	printf("Options:\n");
+	printf("  -q                  quiet, only set the exit status\n");
+	printf("  -h                  print this help\n");
+	printf("A name matches if it is listed or is a subdomain of a listed one.\n");
+	printf("Exit status is 0 if all names match, 1 if any does not.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct dsmatch m;
+	int quiet = 0, batch = 0, bench = 0, missed = 0, opt, ret, i;
+
+	while ((opt = getopt(argc, argv, "qbBh")) != -1) {
+		switch (opt) {
+		case 'q':
+			quiet = 1;
+			break;
+		case 'b':
+			batch = 1;
+			break;
+		case 'B':
+			bench = 1;
+			break;
+		case 'h':
+			print_help(argc, argv);
+			exit(0);
+		default:
+			print_help(argc, argv);
+			exit(2);
+		}
+	}
+	if (argc - optind < (batch ? 1 : 2)) {
+		print_help(argc, argv);
+		exit(2);
+	}
+
+	if (bench) {
+		ret = lookup_bench(argv[optind], argv[optind + 1], optind + 2 < argc ?
+				strtoul(argv[optind + 2], NULL, 10) : 1000000);
+		return ret < 0 ? 2 : ret;
+	}
+
+	if ((ret = dsmatch_open(&m, argv[optind])) < 0) {
+		fprintf(stderr, "*** Cannot load '%s': %s.\n", argv[optind], strerror(-ret));
+		exit(2);
+	}
+
+	if (batch) {
+		ret = lookup_stream(&m, quiet);
+		dsmatch_close(&m);
+		return ret < 0 ? 2 : ret;
+	}
+
+	for (i = optind + 1; i < argc; i++) {
+		int found = dsmatch_lookup(&m, argv[i], strlen(argv[i]));
+		if (!found)
+			missed++;
+		if (!quiet)
+			printf("%s %s\n", argv[i], found ? "yes" : "no");
+	}
+
+	dsmatch_close(&m);
+
+	return missed ? 1 : 0;
+}
@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "dsmatch.h"
+#include "rtable.h"
+
+int dsmatch_write(FILE *fp, char * const *names, uint32_t nr)
+{
+	struct dsmatch_header hdr;
+	struct dsmatch_slot *slots;
+	uint8_t *pool;
+	uint32_t nr_slots = 16, i, crc;
+	size_t pool_size = 0, off = 0;
+	int ret = 0;
+
+	/* Keep the load factor at most 1/2 */
+	while (nr_slots < (uint64_t)nr * 2)
+		nr_slots *= 2;
+	for (i = 0; i < nr; i++) {
+		if (strlen(names[i]) > 255)
+			return -EINVAL;
+		pool_size += 1 + strlen(names[i]);
+	}
+	pool_size = (pool_size + 7) & ~(size_t)7;
+	if (pool_size >= 0xffffffff)
+		return -E2BIG;
+
+	slots = (struct dsmatch_slot *)calloc(nr_slots, sizeof(struct dsmatch_slot));
+	pool = (uint8_t *)calloc(1, pool_size ? pool_size : 1);
+	if (!slots || !pool) {
+		free(slots);
+		free(pool);
+		return -ENOMEM;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = DSMATCH_MAGIC;
+	hdr.version = DSMATCH_VERSION;
+	hdr.header_size = sizeof(hdr);
+	hdr.nr_names = nr;
+	hdr.nr_slots = nr_slots;
+	hdr.pool_size = pool_size;
+
+	for (i = 0; i < nr; i++) {
+		const char *s = names[i];
+		size_t len = strlen(s), j;
+		uint32_t h = DSMATCH_HASH_INIT, labels = 1, k;
+
+		pool[off] = len;
+		for (j = 0; j < len; j++) {
+			uint8_t c = s[j];
+			pool[off + 1 + j] = (c >= 'A' && c <= 'Z') ? c + 'a' - 'A' : c;
+			labels += c == '.';
+		}
+		for (j = len; j-- > 0; )
+			h = dsmatch_hash_step(h, s[j]);
+		if (labels > hdr.max_labels)
+			hdr.max_labels = labels;
+
+		for (k = (h ^ (h >> 16)) & (nr_slots - 1); slots[k].name; k = (k + 1) & (nr_slots - 1))
+			;
+		slots[k].hash = h;
+		slots[k].name = off + 1;
+		off += 1 + len;
+	}
+
+	crc = rtable_crc32(0, slots, sizeof(struct dsmatch_slot) * nr_slots);
+	hdr.checksum = rtable_crc32(crc, pool, pool_size);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+		fwrite(slots, sizeof(struct dsmatch_slot), nr_slots, fp) != nr_slots ||
+		(pool_size && fwrite(pool, 1, pool_size, fp) != pool_size) ||
+		fflush(fp) != 0)
+		ret = -EIO;
+
+	free(slots);
+	free(pool);
+	return ret;
+}
+
+int dsmatch_open(struct dsmatch *m, const char *path)
+{
+	const struct dsmatch_header *hdr;
+	struct stat st;
+	uint32_t crc, i;
+	int fd, ret = 0;
+
+	memset(m, 0, sizeof(*m));
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0) {
+		ret = -errno;
+	} else if (st.st_size < sizeof(*hdr)) {
+		fprintf(stderr, "[%s] '%s' is too short for a snapshot.\n", __FUNCTION__, path);
+		ret = -EINVAL;
+	} else {
+		m->map_len = st.st_size;
+		m->map_base = mmap(NULL, m->map_len, PROT_READ, MAP_SHARED, fd, 0);
+		if (m->map_base == MAP_FAILED) {
+			m->map_base = NULL;
+			ret = -errno;
+		}
+	}
+	close(fd);
+	if (ret < 0)
+		return ret;
+
+	hdr = m->map_base;
+	if (hdr->magic != DSMATCH_MAGIC) {
+		fprintf(stderr, "[%s] '%s' is not a domain snapshot, or of other byte order.\n",
+				__FUNCTION__, path);
+		goto fail;
+	}
+	if (hdr->version != DSMATCH_VERSION) {
+		fprintf(stderr, "[%s] '%s' has unsupported version %u.\n",
+				__FUNCTION__, path, hdr->version);
+		goto fail;
+	}
+	if (hdr->header_size < sizeof(*hdr) || hdr->header_size % 8 ||
+		hdr->nr_slots == 0 || (hdr->nr_slots & (hdr->nr_slots - 1)) ||
+		hdr->nr_names >= hdr->nr_slots ||
+		hdr->header_size + (uint64_t)hdr->nr_slots * sizeof(struct dsmatch_slot) +
+			hdr->pool_size != m->map_len) {
+		fprintf(stderr, "[%s] '%s' has a bad size.\n", __FUNCTION__, path);
+		goto fail;
+	}
+
+	m->hdr = hdr;
+	m->slots = (const struct dsmatch_slot *)((const char *)m->map_base + hdr->header_size);
+	m->pool = (const uint8_t *)(m->slots + hdr->nr_slots);
+	m->mask = hdr->nr_slots - 1;
+	m->max_labels = hdr->max_labels;
+
+	crc = rtable_crc32(0, m->slots, sizeof(struct dsmatch_slot) * hdr->nr_slots);
+	if (rtable_crc32(crc, m->pool, hdr->pool_size) != hdr->checksum) {
+		fprintf(stderr, "[%s] '%s' has a bad checksum.\n", __FUNCTION__, path);
+		goto fail;
+	}
+	/* Names must lie inside the pool */
+	for (i = 0; i < hdr->nr_slots; i++) {
+		uint32_t off = m->slots[i].name;
+		if (off && (off > hdr->pool_size ||
+			(uint64_t)off + m->pool[off - 1] > hdr->pool_size)) {
+			fprintf(stderr, "[%s] '%s' has a bad name offset.\n", __FUNCTION__, path);
+			goto fail;
+		}
+	}
+	return 0;
+
+fail:
+	dsmatch_close(m);
+	return -EINVAL;
+}
+
+void dsmatch_close(struct dsmatch *m)
+{
+	if (m->map_base)
+		munmap(m->map_base, m->map_len);
+	memset(m, 0, sizeof(*m));
+}
@@ -0,0 +1,123 @@
+#ifndef __DSMATCH_H
+#define __DSMATCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Compiled domain suffix matcher, as written by 'domain-merger -o snapshot':
+ *
+ *   struct dsmatch_header
+ *   struct dsmatch_slot[nr_slots]   open addressing hash of the domains
+ *   pool[pool_size]                 each domain as <u8 len><lowercase text>
+ *
+ * A domain is hashed from its last character backwards, so while a query
+ *  name is walked from the right, the hash of every suffix ending at a
+ *  label boundary comes for free and each label costs one probe. Stored
+ *  in host byte order and used right from the mapped file.
+ */
+#define DSMATCH_MAGIC      0x44534d31  /* "DSM1" */
+#define DSMATCH_VERSION    1
+
+#define DSMATCH_MAX_NAME   253
+
+struct dsmatch_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t header_size;
+	uint32_t checksum;      /* CRC-32 of the slots and the pool */
+	uint32_t nr_names;
+	uint32_t nr_slots;      /* power of 2 */
+	uint32_t max_labels;    /* labels of the longest domain */
+	uint32_t pool_size;
+};
+
+struct dsmatch_slot {
+	uint32_t hash;
+	uint32_t name;          /* offset into the pool + 1, 0 for an empty slot */
+};
+
+struct dsmatch {
+	const struct dsmatch_header *hdr;
+	const struct dsmatch_slot *slots;
+	const uint8_t *pool;
+	uint32_t mask;
+	uint32_t max_labels;
+	void  *map_base;
+	size_t map_len;
+};
+
+#define DSMATCH_HASH_INIT  2166136261u
+
+/* FNV-1a step, on lowercase characters */
+static inline uint32_t dsmatch_hash_step(uint32_t h, uint8_t c)
+{
+	if (c >= 'A' && c <= 'Z')
+		c += 'a' - 'A';
+	return (h ^ c) * 16777619u;
+}
+
+/* Write the snapshot of 'nr' domains, none covering another, to 'fp' */
+int dsmatch_write(FILE *fp, char * const *names, uint32_t nr);
+
+/* Map a snapshot file read-only and check it */
+int dsmatch_open(struct dsmatch *m, const char *path);
+void dsmatch_close(struct dsmatch *m);
+
+/* Is the suffix 's' of 'len' bytes, hashed to 'h', one of the domains? */
+static inline int dsmatch_probe(const struct dsmatch *m, uint32_t h,
+		const char *s, size_t len)
+{
+	uint32_t i = (h ^ (h >> 16)) & m->mask;
+
+	for (;; i = (i + 1) & m->mask) {
+		const struct dsmatch_slot *slot = &m->slots[i];
+		const uint8_t *name;
+		size_t j;
+
+		if (!slot->name)
+			return 0;
+		if (slot->hash != h)
+			continue;
+		name = m->pool + slot->name - 1;
+		if (name[0] != len)
+			continue;
+		for (j = 0; j < len; j++) {
+			uint8_t c = s[j];
+			if (c >= 'A' && c <= 'Z')
+				c += 'a' - 'A';
+			if (c != name[1 + j])
+				break;
+		}
+		if (j == len)
+			return 1;
+	}
+}
+
+/**
+ * Return 1 if 'name' (not NUL terminated, may end with a dot) is one of
+ *  the domains or a subdomain of one, 0 otherwise.
+ */
+static inline int dsmatch_lookup(const struct dsmatch *m, const char *name, size_t len)
+{
+	uint32_t h = DSMATCH_HASH_INIT, labels = 0;
+	size_t i;
+
+	if (len > 0 && name[len - 1] == '.')
+		len--;
+	for (i = len; i-- > 0; ) {
+		if (name[i] == '.') {
+			if (dsmatch_probe(m, h, name + i + 1, len - i - 1))
+				return 1;
+			/* Longer suffixes than any domain cannot match */
+			if (++labels >= m->max_labels)
+				return 0;
+		}
+		h = dsmatch_hash_step(h, name[i]);
+	}
+	return len > 0 && dsmatch_probe(m, h, name, len);
+}
+
+#endif /* __DSMATCH_H */
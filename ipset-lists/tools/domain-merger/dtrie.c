@@ -0,0 +1,242 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dtrie.h"
+
+static inline uint32_t dtrie_hash(uint32_t parent, const char *label, size_t len)
+{
+	uint32_t h = 2166136261u ^ parent;   /* FNV-1a */
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ (uint8_t)label[i]) * 16777619u;
+	return h ^ (h >> 15);
+}
+
+static int dtrie_rehash(struct dtrie *t, uint32_t nr_buckets)
+{
+	uint32_t *buckets, n;
+
+	if (!(buckets = (uint32_t *)calloc(nr_buckets, sizeof(uint32_t))))
+		return -ENOMEM;
+	for (n = 1; n < t->nr_nodes; n++) {
+		const struct dtrie_node *node = &t->nodes[n];
+		uint32_t b = dtrie_hash(node->parent, t->pool + node->label,
+				node->label_len) & (nr_buckets - 1);
+		t->nodes[n].hash_next = buckets[b];
+		buckets[b] = n;
+	}
+	free(t->buckets);
+	t->buckets = buckets;
+	t->nr_buckets = nr_buckets;
+	return 0;
+}
+
+int dtrie_init(struct dtrie *t)
+{
+	memset(t, 0, sizeof(*t));
+	t->nodes_size = 1024;
+	if (!(t->nodes = (struct dtrie_node *)malloc(sizeof(struct dtrie_node) * t->nodes_size)))
+		return -ENOMEM;
+	memset(&t->nodes[DTRIE_ROOT], 0, sizeof(struct dtrie_node));
+	t->nr_nodes = 1;
+	if (dtrie_rehash(t, 1024) < 0) {
+		dtrie_free(t);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void dtrie_free(struct dtrie *t)
+{
+	free(t->nodes);
+	free(t->buckets);
+	free(t->pool);
+	memset(t, 0, sizeof(*t));
+}
+
+/* Find the child of 'parent' with 'label', 0 for none */
+static uint32_t dtrie_find(const struct dtrie *t, uint32_t parent, uint32_t h,
+		const char *label, size_t len)
+{
+	uint32_t n;
+
+	for (n = t->buckets[h & (t->nr_buckets - 1)]; n; n = t->nodes[n].hash_next) {
+		const struct dtrie_node *node = &t->nodes[n];
+		if (node->parent == parent && node->label_len == len &&
+			memcmp(t->pool + node->label, label, len) == 0)
+			return n;
+	}
+	return 0;
+}
+
+/* Find the child of 'parent' with 'label', or add it */
+static int dtrie_child(struct dtrie *t, uint32_t parent, const char *label,
+		size_t len, uint32_t *child)
+{
+	uint32_t h = dtrie_hash(parent, label, len), n;
+	struct dtrie_node *node;
+
+	if ((n = dtrie_find(t, parent, h, label, len))) {
+		*child = n;
+		return 0;
+	}
+
+	if (t->nr_nodes >= t->nodes_size) {
+		struct dtrie_node *p = (struct dtrie_node *)realloc(t->nodes,
+				sizeof(struct dtrie_node) * t->nodes_size * 2);
+		if (!p)
+			return -ENOMEM;
+		t->nodes = p;
+		t->nodes_size *= 2;
+	}
+	if (t->pool_len + len > t->pool_size) {
+		size_t new_size = t->pool_size ? t->pool_size * 2 : 65536;
+		char *p = (char *)realloc(t->pool, new_size);
+		if (!p)
+			return -ENOMEM;
+		t->pool = p;
+		t->pool_size = new_size;
+	}
+
+	n = t->nr_nodes++;
+	node = &t->nodes[n];
+	node->parent = parent;
+	node->label = t->pool_len;
+	node->label_len = len;
+	node->terminal = 0;
+	node->depth = t->nodes[parent].depth + 1;
+	memcpy(t->pool + t->pool_len, label, len);
+	t->pool_len += len;
+
+	*child = n;
+	/* Keep the load factor below 1, rehashing links the new node too */
+	if (t->nr_nodes > t->nr_buckets)
+		return dtrie_rehash(t, t->nr_buckets * 2);
+	h &= t->nr_buckets - 1;
+	node->hash_next = t->buckets[h];
+	t->buckets[h] = n;
+	return 0;
+}
+
+int dtrie_add(struct dtrie *t, const char *name, size_t len)
+{
+	uint32_t n = DTRIE_ROOT;
+	size_t start, end;
+	int ret;
+
+	if (len > 0 && name[len - 1] == '.')
+		len--;
+	if (len == 0 || len > DTRIE_MAX_NAME || name[0] == '.')
+		return -EINVAL;
+
+	/* Walk the labels from the right, stop at a covering domain */
+	for (end = len; ; end = start - 1) {
+		for (start = end; start > 0 && name[start - 1] != '.'; start--)
+			;
+		if (start == end || end - start > 63)
+			return -EINVAL;
+		if (t->nodes[n].terminal)
+			break;
+		if ((ret = dtrie_child(t, n, name + start, end - start, &n)) < 0)
+			return ret;
+		if (start == 0)
+			break;
+	}
+
+	t->nr_domains++;
+	if (t->nodes[n].terminal) {
+		t->nr_covered++;
+		return 0;
+	}
+	t->nodes[n].terminal = 1;
+	return 1;
+}
+
+int dtrie_match(const struct dtrie *t, const char *name, size_t len)
+{
+	uint32_t n = DTRIE_ROOT;
+	size_t start, end;
+
+	if (len > 0 && name[len - 1] == '.')
+		len--;
+	if (len == 0)
+		return 0;
+	for (end = len; ; end = start - 1) {
+		for (start = end; start > 0 && name[start - 1] != '.'; start--)
+			;
+		n = dtrie_find(t, n, dtrie_hash(n, name + start, end - start),
+				name + start, end - start);
+		if (n == 0)
+			return 0;
+		if (t->nodes[n].terminal)
+			return 1;
+		if (start == 0)
+			return 0;
+	}
+}
+
+size_t dtrie_node_name(const struct dtrie *t, uint32_t n, char *s)
+{
+	size_t len = 0;
+
+	for (; n != DTRIE_ROOT; n = t->nodes[n].parent) {
+		const struct dtrie_node *node = &t->nodes[n];
+		if (len)
+			s[len++] = '.';
+		memcpy(s + len, t->pool + node->label, node->label_len);
+		len += node->label_len;
+	}
+	s[len] = '\0';
+	return len;
+}
+
+static int dtrie_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+char **dtrie_collect(const struct dtrie *t, uint32_t *nr)
+{
+	uint32_t *covered, n, count = 0;
+	size_t names_len = 0;
+	char **list, *s;
+
+	/* A node is covered if any ancestor is terminal; parents come first */
+	if (!(covered = (uint32_t *)calloc((t->nr_nodes + 31) / 32, sizeof(uint32_t))))
+		return NULL;
+	for (n = 1; n < t->nr_nodes; n++) {
+		uint32_t p = t->nodes[n].parent;
+		if (p != DTRIE_ROOT && (t->nodes[p].terminal ||
+			(covered[p / 32] & (1u << (p % 32))))) {
+			covered[n / 32] |= 1u << (n % 32);
+		} else if (t->nodes[n].terminal) {
+			uint32_t m;
+			count++;
+			for (m = n; m != DTRIE_ROOT; m = t->nodes[m].parent)
+				names_len += t->nodes[m].label_len + 1;
+		}
+	}
+
+	/* The pointers and the names in one block */
+	if (!(list = (char **)malloc(sizeof(char *) * (count + 1) + names_len))) {
+		free(covered);
+		return NULL;
+	}
+	s = (char *)(list + count + 1);
+	for (count = 0, n = 1; n < t->nr_nodes; n++) {
+		if (!t->nodes[n].terminal || (covered[n / 32] & (1u << (n % 32))))
+			continue;
+		list[count++] = s;
+		s += dtrie_node_name(t, n, s) + 1;
+	}
+	list[count] = NULL;
+	free(covered);
+
+	qsort(list, count, sizeof(char *), dtrie_name_cmp);
+	*nr = count;
+	return list;
+}
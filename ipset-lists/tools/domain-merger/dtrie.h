@@ -0,0 +1,60 @@
+#ifndef __DTRIE_H
+#define __DTRIE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Domain trie with the labels reversed: "www.google.com" is the path
+ *  com -> google -> www. Nodes live in one array and are found through
+ *  a hash of (parent, label), so a node with 10k children costs the same
+ *  as one with 2. A domain marked 'terminal' covers all its subdomains.
+ */
+struct dtrie_node {
+	uint32_t parent;
+	uint32_t hash_next;     /* next node in the same hash bucket */
+	uint32_t label;         /* offset into the label pool */
+	uint8_t  label_len;
+	uint8_t  terminal;
+	uint16_t depth;         /* number of labels, 0 for the root */
+};
+
+struct dtrie {
+	struct dtrie_node *nodes;
+	uint32_t nr_nodes;
+	uint32_t nodes_size;
+	uint32_t *buckets;      /* node index, 0 for none (the root is never hashed) */
+	uint32_t nr_buckets;    /* power of 2 */
+	char    *pool;
+	size_t   pool_len;
+	size_t   pool_size;
+	uint32_t nr_domains;    /* domains added, including covered ones */
+	uint32_t nr_covered;    /* ... of which were covered by a shorter one */
+};
+
+#define DTRIE_ROOT 0
+#define DTRIE_MAX_NAME 253
+
+int dtrie_init(struct dtrie *t);
+void dtrie_free(struct dtrie *t);
+
+/* Return 1 if added, 0 if already covered, or -EINVAL/-ENOMEM */
+int dtrie_add(struct dtrie *t, const char *name, size_t len);
+
+/**
+ * Return 1 if 'name' (not NUL terminated, lowercase) is one of the
+ *  domains or a subdomain of one, 0 otherwise.
+ */
+int dtrie_match(const struct dtrie *t, const char *name, size_t len);
+
+/* Write "label.label.tld" of node 'n' to 's', return the length */
+size_t dtrie_node_name(const struct dtrie *t, uint32_t n, char *s);
+
+/**
+ * Return the least specific domains left, each covering none of the
+ *  others, sorted in byte order: an array of 'nr' names, NULL terminated,
+ *  to be released with a single free().
+ */
+char **dtrie_collect(const struct dtrie *t, uint32_t *nr);
+
+#endif /* __DTRIE_H */
@@ -0,0 +1,350 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+
+#include "rtable.h"
+
+#define BATCH_SIZE  4096
+
+/* Either kind of table file */
+struct table {
+	int is_dir;
+	struct rtable rt;
+	struct rtable_dir rd;
+};
+
+static int table_open(struct table *t, const char *path)
+{
+	uint32_t magic = 0;
+	FILE *fp;
+
+	memset(t, 0, sizeof(*t));
+	if (!(fp = fopen(path, "r")))
+		return -errno;
+	if (fread(&magic, sizeof(magic), 1, fp) != 1)
+		magic = 0;
+	fclose(fp);
+
+	if (magic == RTABLE_DIR_MAGIC) {
+		t->is_dir = 1;
+		return rtable_dir_open(&t->rd, path);
+	}
+	return rtable_open(&t->rt, path);
+}
+
+static void table_close(struct table *t)
+{
+	if (t->is_dir)
+		rtable_dir_close(&t->rd);
+	else
+		rtable_close(&t->rt);
+}
+
+static inline int table_lookup(const struct table *t, uint32_t ip)
+{
+	return t->is_dir ? rtable_dir_lookup(&t->rd, ip) : rtable_lookup(&t->rt, ip);
+}
+
+static size_t table_lookup_batch(const struct table *t, const uint32_t *ips,
+		uint8_t *hits, size_t n)
+{
+	size_t i, nr_hits = 0;
+
+	if (!t->is_dir)
+		return rtable_lookup_batch(&t->rt, ips, hits, n);
+	for (i = 0; i < n; i++)
+		nr_hits += (hits[i] = rtable_dir_lookup(&t->rd, ips[i]));
+	return nr_hits;
+}
+
+struct batch {
+	uint32_t ips[BATCH_SIZE];
+	uint8_t hits[BATCH_SIZE];
+	const char *text[BATCH_SIZE];
+	size_t text_len[BATCH_SIZE];
+	size_t n;
+};
+
+static size_t batch_flush(const struct table *t, struct batch *b, int quiet)
+{
+	size_t i, nr_hits;
+
+	nr_hits = table_lookup_batch(t, b->ips, b->hits, b->n);
+	for (i = 0; !quiet && i < b->n; i++) {
+		fwrite(b->text[i], 1, b->text_len[i], stdout);
+		fputs(b->hits[i] ? " yes\n" : " no\n", stdout);
+	}
+	b->n = 0;
+	return nr_hits;
+}
+
+/**
+ * Batch mode: classify the first word of each line of stdin, reading
+ *  in large blocks and looking addresses up in groups.
+ */
+static int lookup_stream(const struct table *t, int quiet)
+{
+	static char buf[1 << 20];
+	static struct batch b;
+	size_t len = 0, nr_lines = 0, nr_hits = 0, nr_bad = 0;
+	ssize_t rc;
+
+	for (;;) {
+		char *p, *end, *eol;
+
+		if ((rc = read(STDIN_FILENO, buf + len, sizeof(buf) - len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "*** Failed to read stdin: %s.\n", strerror(errno));
+			return -errno;
+		}
+		len += rc;
+
+		for (p = buf, end = buf + len; p < end; p = eol + 1) {
+			const char *w;
+			if (!(eol = memchr(p, '\n', end - p))) {
+				if (rc > 0)
+					break;
+				eol = end;  /* last line without '\n' */
+			}
+			while (p < eol && (*p == ' ' || *p == '\t'))
+				p++;
+			for (w = p; w < eol && *w != ' ' && *w != '\t' && *w != '\r'; w++)
+				;
+			if (w == p)
+				continue;
+			nr_lines++;
+			if (ipv4_parse_n(p, w - p, &b.ips[b.n]) < 0) {
+				nr_bad++;
+				continue;
+			}
+			b.text[b.n] = p;
+			b.text_len[b.n] = w - p;
+			if (++b.n == BATCH_SIZE)
+				nr_hits += batch_flush(t, &b, quiet);
+		}
+		/* Text of pending entries lives in 'buf', finish them first */
+		nr_hits += batch_flush(t, &b, quiet);
+
+		if (rc == 0)
+			break;
+		len = end - p;
+		memmove(buf, p, len);
+		if (len == sizeof(buf)) {
+			fprintf(stderr, "*** Line too long on stdin.\n");
+			return -EINVAL;
+		}
+	}
+
+	fprintf(stderr, "%zu addresses, %zu in table, %zu invalid\n",
+			nr_lines - nr_bad, nr_hits, nr_bad);
+	return nr_hits == nr_lines ? 0 : 1;
+}
+
+static int bsearch_cmp(const void *key, const void *elem)
+{
+	uint32_t ip = *(const uint32_t *)key;
+	const struct ipv4_range *r = elem;
+
+	if (ip < r->start)
+		return -1;
+	if (ip > r->end)
+		return 1;
+	return 0;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_report(const char *name, size_t count, double t,
+		size_t nr_hits, size_t mem)
+{
+	printf("  %-20s %8.2f M/s %7.1f ns  %8zu KiB  (%zu hits)\n", name,
+			count / t / 1e6, t * 1e9 / count, (mem + 1023) / 1024, nr_hits);
+}
+
+/**
+ * Benchmark the lookup kernels on random addresses, report their speed
+ *  next to their memory footprint, and make sure they all agree.
+ */
+static int lookup_bench(struct rtable *rt, size_t count)
+{
+	struct rtable_dir rd;
+	uint32_t *ips, x = 2463534242U;
+	uint8_t *ref, *hits;
+	size_t i, n, mismatches = 0;
+	size_t ranges_mem = sizeof(struct ipv4_range) * rt->count;
+	double t;
+
+	ips = malloc(sizeof(uint32_t) * count);
+	ref = malloc(count);
+	hits = malloc(count);
+	if (!ips || !ref || !hits)
+		return -ENOMEM;
+	if (rtable_build_index(rt) < 0 || rtable_dir_build(&rd, rt->ranges, rt->count) < 0) {
+		fprintf(stderr, "*** Cannot build the search tables.\n");
+		return -ENOMEM;
+	}
+
+	/* Half of the addresses are taken from inside the table */
+	for (i = 0; i < count; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		if ((i & 1) && rt->count) {
+			const struct ipv4_range *r = &rt->ranges[x % rt->count];
+			ips[i] = r->start + (x >> 8) % ((uint64_t)r->end - r->start + 1);
+		} else {
+			ips[i] = x;
+		}
+	}
+
+	printf("%zu ranges, %zu lookups\n", rt->count, count);
+	printf("  %-20s %12s %10s %12s\n", "method", "throughput", "latency", "memory");
+
+	t = now_sec();
+	for (i = 0, n = 0; i < count; i++)
+		n += (ref[i] = bsearch(&ips[i], rt->ranges, rt->count,
+				sizeof(struct ipv4_range), bsearch_cmp) != NULL);
+	t = now_sec() - t;
+	bench_report("bsearch(3)", count, t, n, ranges_mem);
+
+	t = now_sec();
+	for (i = 0, n = 0; i < count; i++)
+		n += (hits[i] = rtable_lookup(rt, ips[i]));
+	t = now_sec() - t;
+	mismatches += memcmp(ref, hits, count) != 0;
+	bench_report("binary search", count, t, n, ranges_mem);
+
+	t = now_sec();
+	n = rtable_lookup_batch(rt, ips, hits, count);
+	t = now_sec() - t;
+	mismatches += memcmp(ref, hits, count) != 0;
+	bench_report(
+#ifdef __SSE2__
+			"/16 index, SSE2",
+#else
+			"/16 index, scalar",
+#endif
+			count, t, n, ranges_mem +
+			sizeof(uint32_t) * (RTABLE_BUCKETS + 1 + rt->count + RTABLE_STARTS_PAD));
+
+	t = now_sec();
+	for (i = 0, n = 0; i < count; i++)
+		n += (hits[i] = rtable_dir_lookup(&rd, ips[i]));
+	t = now_sec() - t;
+	mismatches += memcmp(ref, hits, count) != 0;
+	bench_report("DIR-16-8-8", count, t, n, rtable_dir_size(&rd));
+	printf("  (DIR-16-8-8: %u second level and %u third level blocks)\n",
+			rd.nr_l2, rd.nr_l3);
+
+	rtable_dir_close(&rd);
+	free(ips);
+	free(ref);
+	free(hits);
+
+	if (mismatches) {
+		fprintf(stderr, "*** Lookup methods disagree!\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static void print_help(int argc, char *argv[])
+{
+	printf("Classify IPv4 addresses against a table built by 'ipv4-merger -o table|dir'.\n");
+	printf("Usage:\n");
+	printf("  %s [options] <table> <address> [address ...]\n", argv[0]);
+	printf("  %s -b [-q] <table>           classify one address per line from stdin\n", argv[0]);
+	printf("  %s -B <table> [count]        benchmark lookup methods on random addresses\n", argv[0]);
+	printf("                                      ('-o table' tables only)\n");
+	printf("Options:\n");
+	printf("  -q                  quiet, only set the exit status\n");
+	printf("  -h                  print this help\n");
+	printf("Exit status is 0 if all addresses are in the table, 1 if any is not.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct table t;
+	int quiet = 0, batch = 0, bench = 0, missed = 0, opt, ret, i;
+
+	while ((opt = getopt(argc, argv, "qbBh")) != -1) {
+		switch (opt) {
+		case 'q':
+			quiet = 1;
+			break;
+		case 'b':
+			batch = 1;
+			break;
+		case 'B':
+			bench = 1;
+			break;
+		case 'h':
+			print_help(argc, argv);
+			exit(0);
+		default:
+			print_help(argc, argv);
+			exit(2);
+		}
+	}
+	if (argc - optind < ((batch || bench) ? 1 : 2)) {
+		print_help(argc, argv);
+		exit(2);
+	}
+
+	if ((ret = table_open(&t, argv[optind])) < 0) {
+		fprintf(stderr, "*** Cannot load '%s': %s.\n", argv[optind], strerror(-ret));
+		exit(2);
+	}
+
+	if (bench) {
+		if (t.is_dir) {
+			fprintf(stderr, "*** Benchmarks need a range table ('-o table').\n");
+			exit(2);
+		}
+		ret = lookup_bench(&t.rt, optind + 1 < argc ?
+				strtoul(argv[optind + 1], NULL, 10) : 10000000);
+		table_close(&t);
+		return ret < 0 ? 2 : ret;
+	}
+
+	if (batch) {
+		if (!t.is_dir && rtable_build_index(&t.rt) < 0) {
+			fprintf(stderr, "*** Cannot build the search index.\n");
+			exit(2);
+		}
+		ret = lookup_stream(&t, quiet);
+		table_close(&t);
+		return ret < 0 ? 2 : ret;
+	}
+
+	for (i = optind + 1; i < argc; i++) {
+		struct in_addr in;
+		int found;
+
+		if (inet_pton(AF_INET, argv[i], &in) != 1) {
+			fprintf(stderr, "*** Invalid IPv4 address '%s'.\n", argv[i]);
+			exit(2);
+		}
+		found = table_lookup(&t, ntohl(in.s_addr));
+		if (!found)
+			missed++;
+		if (!quiet)
+			printf("%s %s\n", argv[i], found ? "yes" : "no");
+	}
+
+	table_close(&t);
+
+	return missed ? 1 : 0;
+}
@@ -0,0 +1,364 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "rtable.h"
+#include "salist6.h"
+#include "ipsetsize.h"
+#include "nlipset.h"
+
+/**
+ * Load a set into the kernel in place of 'ipset restore', from either
+ *  - a range table built by 'ipv4-merger -o table', or
+ *  - an ipset restore file or a CIDR list, as the route tools write.
+ *  The set is created with a hash sized for the entries, and filled with
+ *  large netlink batches. A set already loaded is refilled through a
+ *  temporary set and a swap, so it is never seen partly loaded.
+ * Exits 0 when loaded, 3 when loaded without some invalid lines, 1 when
+ *  nothing was loaded (a set it created is removed again), 2 on bad usage.
+ */
+
+#define EXIT_SKIPPED  3
+
+struct entry {
+	struct ipv6_addr addr;    /* IPv4 in 'addr.lo' */
+	int cidr;
+};
+
+struct entry_list {
+	struct entry *base;
+	size_t length;
+	size_t size;
+	int    inet6;
+	int    errors;
+	char   name[32];          /* from the create line */
+	char   type[32];
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int entry_add(struct entry_list *el, const struct ipv6_addr *addr, int cidr)
+{
+	if (el->length >= el->size) {
+		size_t size = el->size ? el->size * 2 : 4096;
+		struct entry *base = realloc(el->base, size * sizeof(struct entry));
+		if (!base)
+			return -ENOMEM;
+		el->base = base;
+		el->size = size;
+	}
+	el->base[el->length].addr = *addr;
+	el->base[el->length].cidr = cidr;
+	el->length++;
+	return 0;
+}
+
+/* Split the table ranges into networks */
+static int load_table(struct entry_list *el, const char *path)
+{
+	struct rtable rt;
+	size_t i;
+	int ret;
+
+	if ((ret = rtable_open(&rt, path)) < 0)
+		return ret;
+	for (i = 0; i < rt.count; i++) {
+		uint32_t net = rt.ranges[i].start, end = rt.ranges[i].end;
+		for (;;) {
+			struct ipv6_addr a = { 0, net };
+			int bits = ipv4_net_bits(net, end);
+			uint32_t last = ipv4_net_last(net, bits);
+
+			if ((ret = entry_add(el, &a, bits)) < 0) {
+				rtable_close(&rt);
+				return ret;
+			}
+			if (last >= end)
+				break;
+			net = last + 1;
+		}
+	}
+	rtable_close(&rt);
+	return 0;
+}
+
+/* "address" or "address/prefix_len" of the list family */
+static int entry_parse(struct entry_list *el, const char *s)
+{
+	const char *slash = strchr(s, '/');
+	size_t len = slash ? (size_t)(slash - s) : strlen(s);
+	int max_bits = el->inet6 ? 128 : 32, cidr = max_bits;
+	struct ipv6_addr a = { 0, 0 };
+
+	if (slash) {
+		char *e;
+		long v = strtol(slash + 1, &e, 10);
+		if (e == slash + 1 || *e || v < 0 || v > max_bits)
+			return -EINVAL;
+		cidr = v;
+	}
+	if (el->inet6) {
+		if (ipv6_parse_n(s, len, &a) < 0)
+			return -EINVAL;
+	} else {
+		uint32_t ip;
+		if (ipv4_parse_n(s, len, &ip) < 0)
+			return -EINVAL;
+		a.lo = ip;
+	}
+	return entry_add(el, &a, cidr);
+}
+
+/**
+ * Read an ipset restore file or one entry per line. The "create" line
+ *  gives the set name, type and family; only "add" lines of that set
+ *  are taken.
+ */
+static int load_text(struct entry_list *el, const char *path)
+{
+	char line[256], *s;
+	FILE *fp;
+	int ret = 0;
+
+	if (!(fp = fopen(path, "r")))
+		return -errno;
+	while (fgets(line, sizeof(line), fp)) {
+		char *argv[8];
+		int argc = 0;
+
+		for (s = strtok(line, " \t\r\n"); s && argc < 8; s = strtok(NULL, " \t\r\n"))
+			argv[argc++] = s;
+		if (argc == 0 || argv[0][0] == '#')
+			continue;
+
+		if (strcmp(argv[0], "create") == 0) {
+			int i;
+			if (argc < 3 || strlen(argv[1]) >= sizeof(el->name) ||
+				strlen(argv[2]) >= sizeof(el->type)) {
+				el->errors++;
+				continue;
+			}
+			strcpy(el->name, argv[1]);
+			strcpy(el->type, argv[2]);
+			for (i = 3; i + 1 < argc; i++) {
+				if (strcmp(argv[i], "family") == 0)
+					el->inet6 = strcmp(argv[i + 1], "inet6") == 0;
+			}
+			continue;
+		} else if (strcmp(argv[0], "add") == 0) {
+			if (argc < 3 || (el->name[0] && strcmp(argv[1], el->name))) {
+				el->errors++;
+				continue;
+			}
+			s = argv[2];
+		} else if (argc == 1) {
+			s = argv[0];
+		} else {
+			el->errors++;
+			continue;
+		}
+
+		if ((ret = entry_parse(el, s)) == -ENOMEM)
+			break;
+		if (ret < 0) {
+			fprintf(stderr, "*** Invalid entry: %s\n", s);
+			el->errors++;
+		}
+		ret = 0;
+	}
+	fclose(fp);
+	return ret;
+}
+
+static void entry_to_bytes(const struct ipv6_addr *a, uint8_t ip[16])
+{
+	int i;
+	for (i = 0; i < 8; i++) {
+		ip[i] = a->hi >> (56 - 8 * i);
+		ip[8 + i] = a->lo >> (56 - 8 * i);
+	}
+}
+
+static void print_help(int argc, char *argv[])
+{
+	printf("Load an IP set into the kernel over netlink, in place of 'ipset restore'.\n");
+	printf("Usage:\n");
+	printf("  %s [options] <file>\n", argv[0]);
+	printf("The file is a table from 'ipv4-merger -o table', an ipset restore file,\n");
+	printf("or a list of addresses and networks.\n");
+	printf("Options:\n");
+	printf("  -n <name>           set name (default: from the \"create\" line)\n");
+	printf("  -t <type>           set type (default: from the \"create\" line, or hash:net)\n");
+	printf("  -6                  the list is IPv6 (implied by \"family inet6\")\n");
+	printf("  -H <hashsize>       initial hash size (default: sized for the entries)\n");
+	printf("  -M <maxelem>        maximum number of entries (default: twice the entries)\n");
+	printf("  -q                  do not report the timing\n");
+	printf("  -h                  print this help\n");
+	printf("Exit status: 0 loaded, %d loaded without some invalid lines,\n", EXIT_SKIPPED);
+	printf("1 nothing loaded, 2 bad usage.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct entry_list el;
+	struct nlipset *nl;
+	const char *path, *set_name = NULL, *set_type = NULL;
+	char load_name[32];
+	uint32_t hashsize = 0, maxelem = 0, magic = 0;
+	double t0, t_parse, t_create, t_load;
+	int quiet = 0, exists, opt, ret;
+	size_t i;
+	FILE *fp;
+
+	memset(&el, 0, sizeof(el));
+	while ((opt = getopt(argc, argv, "n:t:6H:M:qh")) != -1) {
+		switch (opt) {
+		case 'n':
+			set_name = optarg;
+			break;
+		case 't':
+			set_type = optarg;
+			break;
+		case '6':
+			el.inet6 = 1;
+			break;
+		case 'H':
+			hashsize = strtoul(optarg, NULL, 10);
+			break;
+		case 'M':
+			maxelem = strtoul(optarg, NULL, 10);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 'h':
+			print_help(argc, argv);
+			exit(0);
+		default:
+			print_help(argc, argv);
+			exit(2);
+		}
+	}
+	if (argc - optind != 1) {
+		print_help(argc, argv);
+		exit(2);
+	}
+	path = argv[optind];
+
+	t0 = now_sec();
+	if ((fp = fopen(path, "r"))) {
+		if (fread(&magic, sizeof(magic), 1, fp) != 1)
+			magic = 0;
+		fclose(fp);
+	}
+	if (magic == RTABLE_MAGIC) {
+		if (el.inet6) {
+			fprintf(stderr, "*** Range tables are IPv4 only.\n");
+			exit(2);
+		}
+		ret = load_table(&el, path);
+	} else {
+		ret = load_text(&el, path);
+	}
+	if (ret < 0) {
+		fprintf(stderr, "*** Cannot load '%s': %s.\n", path, strerror(-ret));
+		exit(1);
+	}
+	if (!set_name)
+		set_name = el.name[0] ? el.name : NULL;
+	if (!set_type)
+		set_type = el.type[0] ? el.type : "hash:net";
+	if (!set_name) {
+		fprintf(stderr, "*** No set name in '%s', use '-n'.\n", path);
+		exit(2);
+	}
+	if (strlen(set_name) >= sizeof(load_name)) {
+		fprintf(stderr, "*** Set name '%s' is too long.\n", set_name);
+		exit(2);
+	}
+	t_parse = now_sec();
+
+	if (!hashsize || !maxelem) {
+		uint32_t h, m;
+		ipset_hash_size(el.length, &h, &m);
+		hashsize = hashsize ? hashsize : h;
+		maxelem = maxelem ? maxelem : m;
+	}
+
+	if (!(nl = malloc(sizeof(*nl)))) {
+		fprintf(stderr, "*** Out of memory.\n");
+		exit(1);
+	}
+	if ((ret = nlipset_open(nl, set_name, el.inet6)) < 0 ||
+		(ret = exists = nlipset_exists(nl, set_name)) < 0) {
+		fprintf(stderr, "*** Cannot access the kernel IP sets: %s.\n", nlipset_strerror(ret));
+		exit(1);
+	}
+	if (exists) {
+		/* Fill a new set aside, swap it in at the end */
+		snprintf(load_name, sizeof(load_name), "%.27s-new", set_name);
+		nlipset_destroy(nl, load_name);
+	} else {
+		strcpy(load_name, set_name);
+	}
+	strcpy(nl->name, load_name);
+	if ((ret = nlipset_create(nl, load_name, set_type, hashsize, maxelem)) < 0) {
+		fprintf(stderr, "*** Cannot create set '%s': %s.\n", load_name, nlipset_strerror(ret));
+		exit(1);
+	}
+	t_create = now_sec();
+
+	for (i = 0, ret = 0; i < el.length && ret == 0; i++) {
+		const struct entry *e = &el.base[i];
+		if (el.inet6) {
+			uint8_t ip[16];
+			entry_to_bytes(&e->addr, ip);
+			ret = nlipset_add6(nl, ip, e->cidr);
+		} else {
+			ret = nlipset_add(nl, (uint32_t)e->addr.lo, e->cidr);
+		}
+	}
+	if (ret == 0)
+		ret = nlipset_flush(nl);
+	if (ret < 0) {
+		fprintf(stderr, "*** Cannot add to set '%s': %s.\n", load_name, nlipset_strerror(ret));
+		/* Either the aside copy or a set nobody had before */
+		nlipset_destroy(nl, load_name);
+		exit(1);
+	}
+	if (exists) {
+		if ((ret = nlipset_swap(nl, load_name, set_name)) < 0) {
+			fprintf(stderr, "*** Cannot swap '%s' with '%s': %s.\n", load_name,
+				set_name, nlipset_strerror(ret));
+			nlipset_destroy(nl, load_name);
+			exit(1);
+		}
+		nlipset_destroy(nl, load_name);
+	}
+	t_load = now_sec();
+
+	if (!quiet) {
+		fprintf(stderr, "%s: %lu entries (%d invalid), hashsize %u, maxelem %u, %s.\n",
+			set_name, (unsigned long)nl->nr_sent, el.errors, hashsize, maxelem,
+			exists ? "replaced" : "created");
+		fprintf(stderr, "%s: parse %.1f ms, create %.1f ms, load %.1f ms (%.0f entries/s).\n",
+			set_name, (t_parse - t0) * 1e3, (t_create - t_parse) * 1e3,
+			(t_load - t_create) * 1e3,
+			t_load > t_create ? nl->nr_sent / (t_load - t_create) : 0.0);
+	}
+
+	nlipset_close(nl);
+	free(nl);
+	free(el.base);
+	return el.errors ? EXIT_SKIPPED : 0;
+}
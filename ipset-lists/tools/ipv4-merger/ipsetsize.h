@@ -0,0 +1,24 @@
+#ifndef __IPSETSIZE_H
+#define __IPSETSIZE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * 'hashsize' and 'maxelem' of a hash:net set written for 'nr' entries:
+ *  a bucket per entry, so the kernel never rehashes while it is loaded,
+ *  and room for twice the entries, at least the ipset default.
+ */
+static inline void ipset_hash_size(size_t nr, uint32_t *hashsize, uint32_t *maxelem)
+{
+	uint32_t v;
+
+	for (v = 64; v < nr && v < 0x80000000U; v <<= 1)
+		;
+	*hashsize = v;
+	for (v = 65536; v < 2 * (uint64_t)nr && v < 0x80000000U; v <<= 1)
+		;
+	*maxelem = v;
+}
+
+#endif /* __IPSETSIZE_H */
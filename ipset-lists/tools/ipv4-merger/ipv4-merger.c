@@ -3,9 +3,47 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <pthread.h>
+
+#include "rtable.h"
+#include "salist6.h"
+#include "ipsetsize.h"
+#include "rsort.h"
 
 typedef unsigned gfp_t;
 
+static double now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* '--stats': time spent in each phase, summed over the threads */
+enum sa_phase {
+	PHASE_PARSE,
+	PHASE_SORT,
+	PHASE_MERGE,
+	PHASE_EMIT,
+	NR_PHASES,
+};
+static const char *phase_names[NR_PHASES] = { "parse", "sort", "merge", "emit" };
+static uint64_t phase_us[NR_PHASES];
+
+static inline void phase_add(enum sa_phase phase, double since)
+{
+	__sync_fetch_and_add(&phase_us[phase], (uint64_t)((now_sec() - since) * 1e6));
+}
+
 static inline char *ipv4_hltos(uint32_t u, char *s)
 {
 	static char ss[20];
@@ -17,31 +55,11 @@ static inline char *ipv4_hltos(uint32_t u, char *s)
 	return s;
 }
 
-static inline uint32_t ipv4_stohl(const char *s)
-{
-	int u[4];
-	if (sscanf(s, "%d.%d.%d.%d", &u[0], &u[1], &u[2], &u[3]) == 4) {
-		return  (((uint32_t)u[0] & 0xff) << 24) |
-				(((uint32_t)u[1] & 0xff) << 16) |
-				(((uint32_t)u[2] & 0xff) << 8) |
-				(((uint32_t)u[3] & 0xff));
-	} else
-		return 0xffffffff;
-}
-
-static inline int is_ipv4_addr(const char *s)
-{
-	int u[4];
-	if (sscanf(s, "%d.%d.%d.%d", &u[0], &u[1], &u[2], &u[3]) == 4)
-		return 1;
-	else
-		return 0;
-}
-
 
-struct ipv4_range {
-	uint32_t start;
-	uint32_t end;
+/* A sorted and merged run of ranges, spilled to the temporary file */
+struct sa_run {
+	off_t  offset;
+	size_t length;
 };
 
 struct sa_open_data {
@@ -49,8 +67,18 @@ struct sa_open_data {
 	size_t tmp_size;
 	size_t tmp_length;
 	int    errors;
+	/* Lines read and entries taken from the input, for '--stats' */
+	size_t lines;
+	size_t entries;
+	/* Streaming mode: at most 'max_size' ranges in memory, 0 for no limit */
+	size_t max_size;
+	int    spill_fd;
+	struct sa_run *runs;
+	size_t nr_runs;
 };
 
+static int salist_spill(struct sa_open_data *od, int force);
+
 static int __touch_tmp_base(struct sa_open_data *od, gfp_t gfp)
 {
 	if (!od->tmp_base) {
@@ -85,12 +113,19 @@ static int ipv4_list_add_range(struct sa_open_data *od, uint32_t start,
 	if ((ret = __touch_tmp_base(od, gfp)) < 0)
 		return ret;
 	
+	/* A full run of a bounded list goes to disk rather than growing */
+	if (od->max_size && od->tmp_length + 1 >= od->tmp_size &&
+		od->tmp_size >= od->max_size && (ret = salist_spill(od, 0)) < 0)
+		return ret;
+
 	/* Check if the size is efficient. Enlarge it if needed. */
 	if (od->tmp_length + 1 >= od->tmp_size) {
 		size_t old_size = od->tmp_size;
 		struct ipv4_range *old_base = od->tmp_base;
 		
 		od->tmp_size *= 2;
+		if (od->max_size && od->tmp_size > od->max_size && old_size < od->max_size)
+			od->tmp_size = od->max_size;
 		od->tmp_base = (struct ipv4_range *)realloc(od->tmp_base,
 				sizeof(struct ipv4_range) * od->tmp_size);
 		if (!od->tmp_base) {
@@ -130,71 +165,54 @@ static int ipv4_list_add_net(struct sa_open_data *od, uint32_t net,
 	return ipv4_list_add_netmask(od, net, net_mask, gfp);
 }
 
-static int salist_cmd_parse(struct sa_open_data *od, char *cmd, gfp_t gfp)
+/**
+ * Parse one entry into 'od', 's' needs not be NUL terminated:
+ *   10.10.20.0/24, 10.10.20.0/255.255.255.0 (a contiguous mask),
+ *   10.10.20.0-10.10.20.255, 10.10.20.0:10.10.20.255, or 10.10.20.1
+ * Anything else is counted in 'od->errors'.
+ */
+static int salist_cmd_parse_n(struct sa_open_data *od, const char *s, size_t len)
 {
-	char *a1 = NULL, *a2 = NULL;
-	char *sep;
-	char sc;
-	int n = 32;
+	const char *e = s + len, *sep;
+	uint32_t a1, a2;
+	int ret = 0;
 
-	/* Case 3: Append an item */
-	
-	/* Check IP description part: network segment or range? */
-	if ((sep = strchr(cmd, '/'))) { }
-	else if ((sep = strchr(cmd, '-'))) { }
-	else if ((sep = strchr(cmd, ':'))) { }
-	
-	if (sep) {
-		/* Describes a subnet or range. */
-		sc = *sep;
-		*sep = '\0';
+	for (sep = s; sep < e && *sep != '/' && *sep != '-' && *sep != ':'; sep++)
+		;
+	if (ipv4_parse_n(s, sep - s, &a1) < 0)
+		goto invalid;
 
-		a1 = cmd;
-		a2 = sep + 1;
+	if (sep == e)
+		return ipv4_list_add_range(od, a1, a1, 0);
 
-		if (*a2 == '\0') {
-			fprintf(stderr, "Nothing after '%c'.\n", sc);
-			return -EINVAL;
-		}
-	} else {
-		/* Describes a single IP. */
-		sc = '\0';
-		a1 = cmd;
-	}
-	
-	switch (sc) {
-	case '/':
-		/* 10.10.20.0/24 */
-		/* ------------------------------------ */
-		if (is_ipv4_addr(a2)) {
-			ipv4_list_add_netmask(od, ipv4_stohl(a1), ipv4_stohl(a2), gfp);
+	if (*sep == '/') {
+		const char *q = sep + 1;
+		if (e - q <= 2) {
+			/* 10.10.20.0/24 */
+			int n = 0;
+			for (; q < e && *q >= '0' && *q <= '9'; q++)
+				n = n * 10 + (*q - '0');
+			if (q != e || q == sep + 1 || n > 32)
+				goto invalid;
+			ret = ipv4_list_add_net(od, a1, n, 0);
 		} else {
-			sscanf(a2, "%d", &n);
-			ipv4_list_add_net(od, ipv4_stohl(a1), n, gfp);
+			/* 10.10.20.0/255.255.255.0 */
+			if (ipv4_parse_n(q, e - q, &a2) < 0 || (~a2 & (~a2 + 1)))
+				goto invalid;
+			ret = ipv4_list_add_netmask(od, a1, a2, 0);
 		}
-		/* ------------------------------------ */
-		break;
-	case ':':
-	case '-':
+	} else {
 		/* 10.10.20.0-10.20.0.255 */
-		/* ------------------------------------ */
-		ipv4_list_add_range(od, ipv4_stohl(a1), ipv4_stohl(a2), gfp);
-		/* ------------------------------------ */
-		break;
-	default:
-		if (is_ipv4_addr(a1)) {
-			/* Single IP address. */
-			uint32_t ip = ipv4_stohl(a1);
-			/* ------------------------------------ */
-			ipv4_list_add_range(od, ip, ip, gfp);
-			/* ------------------------------------ */
-		} else {
-			fprintf(stderr, "Invalid IP address '%s'.\n", a1);
-			return -EINVAL;
-		}
-		break;
+		if (ipv4_parse_n(sep + 1, e - sep - 1, &a2) < 0 || a2 < a1)
+			goto invalid;
+		ret = ipv4_list_add_range(od, a1, a2, 0);
 	}
-	return 0;
+	return ret;
+
+invalid:
+	fprintf(stderr, "Invalid entry '%.*s'.\n", (int)len, s);
+	od->errors++;
+	return -EINVAL;
 }
 
 static int ipv4_range_sort_cmp(const void *a, const void *b)
@@ -236,54 +254,309 @@ static struct sa_open_data *salist_open(void)
 	}
 	memset(od, 0, sizeof(*od));
 	od->errors = 0;
+	od->spill_fd = -1;
 
 	return od;
 }
 
-static int salist_close(struct sa_open_data *od)
+/**
+ * Merge the sorted ranges that overlap, touch, or are at most 'gap'
+ *  addresses apart, and return the number of addresses added by filling
+ *  the gaps.
+ */
+static uint64_t salist_merge(struct sa_open_data *od, uint32_t gap)
 {
 	size_t ri, wi;
-	struct ipv4_range *old_base;
+	uint64_t added = 0;
+	double t;
+
+	if (od->tmp_length < 2)
+		return 0;
+	t = now_sec();
+	for (wi = 0, ri = 1; ri < od->tmp_length; ri++) {
+		/* NOTICE: 0xffffffff + 1 ? */
+		if (od->tmp_base[wi].end == (uint32_t)(-1)) {
+			/* Nothing */
+		} else if ((uint64_t)od->tmp_base[ri].start <=
+				(uint64_t)od->tmp_base[wi].end + 1 + gap) {
+			/* The two ranges overlap, so merge the 2nd to the 1st one */
+			if (od->tmp_base[ri].start > od->tmp_base[wi].end + 1)
+				added += od->tmp_base[ri].start - od->tmp_base[wi].end - 1;
+			if (od->tmp_base[ri].end > od->tmp_base[wi].end)
+				od->tmp_base[wi].end = od->tmp_base[ri].end;
+		} else {
+			wi++;
+			if (wi < ri)
+				od->tmp_base[wi] = od->tmp_base[ri];
+		}
+	}
+	od->tmp_length = wi + 1;
+	phase_add(PHASE_MERGE, t);
+	return added;
+}
+
+/* Threads for sorting large lists, see ipv4_range_sort() */
+static int sort_threads = 1;
+
+/* '-s': the sort for all lists, so that each one can be checked and timed */
+enum sort_method {
+	SORT_AUTO,
+	SORT_QSORT,
+	SORT_RADIX,
+};
+static enum sort_method sort_method = SORT_AUTO;
+
+static void salist_sort(struct sa_open_data *od)
+{
+	double t = now_sec();
+
+	/* Radix sort falls back to qsort() when out of memory */
+	if (sort_method == SORT_QSORT || (sort_method == SORT_RADIX &&
+		ipv4_range_radix_sort(od->tmp_base, od->tmp_length) < 0))
+		ipv4_range_qsort(od->tmp_base, od->tmp_length);
+	else if (sort_method == SORT_AUTO)
+		ipv4_range_sort(od->tmp_base, od->tmp_length, sort_threads);
+	phase_add(PHASE_SORT, t);
+}
+
+/* Lists built from sorted ones, e.g. by salist_merge_sorted(), need no sort */
+static int salist_is_sorted(const struct sa_open_data *od)
+{
+	size_t i;
+
+	for (i = 1; i < od->tmp_length; i++) {
+		if (ipv4_range_sort_cmp(&od->tmp_base[i - 1], &od->tmp_base[i]) > 0)
+			return 0;
+	}
+	return 1;
+}
+
+/* Streaming mode ('-m'): ranges in memory per parsed file, 0 for no limit */
+static size_t run_size = 0;
+static size_t nr_spilled = 0, nr_spilled_runs = 0;
+
+/**
+ * Sort and merge the ranges in memory, and unless that frees at least
+ *  half of the run, append them as a sorted run to the temporary file of
+ *  the list, which is created under $TMPDIR (a tmpfs on most systems) and
+ *  unlinked at once. 'force' spills whatever is left.
+ */
+static int salist_spill(struct sa_open_data *od, int force)
+{
+	size_t len, done = 0;
+	struct sa_run *runs;
+	off_t offset = 0;
+	ssize_t rc;
+
+	if (od->tmp_length >= 2) {
+		if (!salist_is_sorted(od))
+			salist_sort(od);
+		salist_merge(od, 0);
+	}
+	if (od->tmp_length == 0 || (!force && od->tmp_length <= od->max_size / 2))
+		return 0;
+
+	if (od->spill_fd < 0) {
+		const char *dir = getenv("TMPDIR");
+		char path[256];
+
+		snprintf(path, sizeof(path), "%s/ipv4-merger.XXXXXX", dir && *dir ? dir : "/tmp");
+		if ((od->spill_fd = mkstemp(path)) < 0) {
+			fprintf(stderr, "[%s] Cannot create '%s': %s.\n", __FUNCTION__, path,
+				strerror(errno));
+			return -errno;
+		}
+		unlink(path);
+	}
+	if (!(runs = realloc(od->runs, sizeof(struct sa_run) * (od->nr_runs + 1))))
+		return -ENOMEM;
+	od->runs = runs;
+	if (od->nr_runs)
+		offset = runs[od->nr_runs - 1].offset +
+			(off_t)(runs[od->nr_runs - 1].length * sizeof(struct ipv4_range));
+
+	len = od->tmp_length * sizeof(struct ipv4_range);
+	while (done < len) {
+		if ((rc = pwrite(od->spill_fd, (char *)od->tmp_base + done, len - done,
+				offset + done)) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "[%s] Cannot write a run: %s.\n", __FUNCTION__, strerror(errno));
+			return -errno;
+		}
+		done += rc;
+	}
+	runs[od->nr_runs].offset = offset;
+	runs[od->nr_runs].length = od->tmp_length;
+	od->nr_runs++;
+	__sync_fetch_and_add(&nr_spilled, od->tmp_length);
+	__sync_fetch_and_add(&nr_spilled_runs, 1);
+	od->tmp_length = 0;
+	return 0;
+}
+
+/* Head of a spilled run during the merge, refilled from the file */
+struct sa_run_reader {
+	struct ipv4_range *buf;
+	size_t buf_len, buf_pos;
+	size_t pos;                   /* of the run, read into 'buf' so far */
+	const struct sa_run *run;
+};
+
+static int sa_run_reader_fill(struct sa_run_reader *rr, int fd, size_t size)
+{
+	size_t n = rr->run->length - rr->pos, len, done = 0;
+	ssize_t rc;
+
+	if (n > size)
+		n = size;
+	len = n * sizeof(struct ipv4_range);
+	while (done < len) {
+		if ((rc = pread(fd, (char *)rr->buf + done, len - done, rr->run->offset +
+				(off_t)(rr->pos * sizeof(struct ipv4_range)) + done)) <= 0) {
+			if (rc < 0 && errno == EINTR)
+				continue;
+			fprintf(stderr, "[%s] Cannot read a run: %s.\n", __FUNCTION__,
+				rc < 0 ? strerror(errno) : "unexpected end of file");
+			return rc < 0 ? -errno : -EIO;
+		}
+		done += rc;
+	}
+	rr->pos += n;
+	rr->buf_len = n;
+	rr->buf_pos = 0;
+	return 0;
+}
+
+static inline uint32_t sa_run_reader_head(const struct sa_run_reader *rr)
+{
+	return rr->buf[rr->buf_pos].start;
+}
+
+/* Restore the min-heap of readers 'heap[0..n)' from position 'i' down */
+static void sa_run_heap_down(struct sa_run_reader **heap, size_t n, size_t i)
+{
+	for (;;) {
+		size_t l = 2 * i + 1, m = i;
+		struct sa_run_reader *tmp;
+
+		if (l < n && sa_run_reader_head(heap[l]) < sa_run_reader_head(heap[m]))
+			m = l;
+		if (l + 1 < n && sa_run_reader_head(heap[l + 1]) < sa_run_reader_head(heap[m]))
+			m = l + 1;
+		if (m == i)
+			return;
+		tmp = heap[i];
+		heap[i] = heap[m];
+		heap[m] = tmp;
+		i = m;
+	}
+}
+
+/**
+ * Replace the ranges of 'od' with the k-way merge of its spilled runs,
+ *  keeping a small buffer of each run in memory. Only the merged result
+ *  grows, and it no longer spills.
+ */
+static int salist_merge_runs(struct sa_open_data *od)
+{
+	struct sa_run_reader *readers, **heap;
+	size_t k, n = 0, size;
+	double t = now_sec();
+	int ret = 0;
+
+	free(od->tmp_base);
+	od->tmp_base = NULL;
+	od->tmp_size = od->tmp_length = 0;
+	od->max_size = 0;
+
+	size = run_size / (od->nr_runs + 1);
+	if (size < 256)
+		size = 256;
+	readers = calloc(od->nr_runs, sizeof(struct sa_run_reader));
+	heap = calloc(od->nr_runs, sizeof(struct sa_run_reader *));
+	if (!readers || !heap) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (k = 0; k < od->nr_runs; k++) {
+		readers[k].run = &od->runs[k];
+		if (!(readers[k].buf = malloc(sizeof(struct ipv4_range) * size))) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		if ((ret = sa_run_reader_fill(&readers[k], od->spill_fd, size)) < 0)
+			goto out;
+		heap[n++] = &readers[k];
+	}
+	for (k = n / 2; k-- > 0; )
+		sa_run_heap_down(heap, n, k);
+
+	while (n) {
+		struct sa_run_reader *rr = heap[0];
+		struct ipv4_range *r = &rr->buf[rr->buf_pos], *last;
+
+		last = od->tmp_length ? &od->tmp_base[od->tmp_length - 1] : NULL;
+		if (last && (uint64_t)r->start <= (uint64_t)last->end + 1) {
+			if (r->end > last->end)
+				last->end = r->end;
+		} else if ((ret = ipv4_list_add_range(od, r->start, r->end, 0)) < 0) {
+			goto out;
+		}
+
+		if (++rr->buf_pos >= rr->buf_len) {
+			if (rr->pos >= rr->run->length) {
+				heap[0] = heap[--n];
+			} else if ((ret = sa_run_reader_fill(rr, od->spill_fd, size)) < 0) {
+				goto out;
+			}
+		}
+		sa_run_heap_down(heap, n, 0);
+	}
+
+out:
+	if (readers) {
+		for (k = 0; k < od->nr_runs; k++)
+			free(readers[k].buf);
+	}
+	free(readers);
+	free(heap);
+	free(od->runs);
+	od->runs = NULL;
+	od->nr_runs = 0;
+	close(od->spill_fd);
+	od->spill_fd = -1;
+	phase_add(PHASE_MERGE, t);
+	return ret;
+}
+
+static int salist_close(struct sa_open_data *od)
+{
+	int ret = 0;
+
+	/* A list that went over its memory budget is merged from its runs */
+	if (od->nr_runs && ((ret = salist_spill(od, 1)) < 0 ||
+		(ret = salist_merge_runs(od)) < 0))
+		fprintf(stderr, "[%s] Failed to merge the spilled runs: %s.\n",
+			__FUNCTION__, strerror(-ret));
 
 	/* Flush the table if any modification has been done */
 	if (od->tmp_base) {
 		/* Sort the table and merge entries as many as possible. */
 		if (od->tmp_length >= 2) {
-			qsort(od->tmp_base, od->tmp_length, sizeof(struct ipv4_range),
-				ipv4_range_sort_cmp);
-			
-			for (wi = 0, ri = 1; ri < od->tmp_length; ri++) {
-				/* NOTICE: 0xffffffff + 1 ? */
-				if (od->tmp_base[wi].end == (uint32_t)(-1)) {
-					/* Nothing */
-				} else if (od->tmp_base[ri].start <= od->tmp_base[wi].end + 1) {
-					/* The two ranges overlap, so merge the 2nd to the 1st one */
-					if (od->tmp_base[ri].end > od->tmp_base[wi].end)
-						od->tmp_base[wi].end = od->tmp_base[ri].end;
-				} else {
-					wi++;
-					if (wi < ri)
-						od->tmp_base[wi] = od->tmp_base[ri];
-				}
-			}
-			
-			od->tmp_length = wi + 1;
+			if (!salist_is_sorted(od))
+				salist_sort(od);
+			salist_merge(od, 0);
 		}
 		
-		/* Reduce the size */
+		/* Reduce the size in place, a failure only leaves it larger */
 		if (od->tmp_length < od->tmp_size) {
-			struct ipv4_range *__tmp = od->tmp_base;
-			od->tmp_base = (struct ipv4_range *)malloc(
-				sizeof(struct ipv4_range) * (od->tmp_length ? od->tmp_length : 1));
-			if (od->tmp_base) {
-				memcpy(od->tmp_base, __tmp,
-					sizeof(struct ipv4_range) * od->tmp_length);
-				free(__tmp);
-			} else {
-				fprintf(stderr, "[%s:%d] Failed to allocate temporary table.\n",
-					__FUNCTION__, __LINE__);
-				/* If failed to allocate new memory, do not reduce it. */
-				od->tmp_base = __tmp;
+			size_t size = od->tmp_length ? od->tmp_length : 1;
+			struct ipv4_range *p = (struct ipv4_range *)realloc(od->tmp_base,
+					sizeof(struct ipv4_range) * size);
+			if (p) {
+				od->tmp_base = p;
+				od->tmp_size = size;
 			}
 		}
 
@@ -295,42 +568,2104 @@ static int salist_close(struct sa_open_data *od)
 				__FUNCTION__, od->errors);
 	}
 
-	return 0;
+	return ret;
 }
 
-static void sa_open_data_dump(struct sa_open_data *od)
+static void salist_free(struct sa_open_data *od)
 {
-	size_t i;
-	char s1[20], s2[20];
+	if (od->spill_fd >= 0)
+		close(od->spill_fd);
+	free(od->runs);
+	free(od->tmp_base);
+	free(od);
+}
 
-	for (i = 0; i < od->tmp_length; i++) {
-		printf("%s-%s\n", ipv4_hltos(od->tmp_base[i].start, s1),
-			ipv4_hltos(od->tmp_base[i].end, s2));
+/* Number of networks that make up the range */
+static unsigned ipv4_range_nets(uint32_t net, uint32_t end)
+{
+	unsigned nr = 0;
+
+	for (;;) {
+		uint32_t last = ipv4_net_last(net, ipv4_net_bits(net, end));
+		nr++;
+		if (last >= end)
+			return nr;
+		net = last + 1;
 	}
 }
 
-int main(int argc, char *argv[])
+struct ipv4_gap {
+	uint32_t size;
+	uint32_t index;     /* between ranges 'index' and 'index + 1' */
+};
+
+static int ipv4_gap_sort_cmp(const void *a, const void *b)
 {
+	const struct ipv4_gap *ga = a, *gb = b;
+
+	if (ga->size != gb->size)
+		return ga->size < gb->size ? -1 : 1;
+	return ga->index < gb->index ? -1 : (ga->index > gb->index);
+}
+
+static size_t group_find(size_t *parent, size_t i)
+{
+	while (parent[i] != i)
+		i = parent[i] = parent[parent[i]];
+	return i;
+}
+
+/**
+ * Fill the gaps between the sorted and merged ranges, smallest first,
+ *  until the ranges make up no more than 'target' networks. Filling the
+ *  n smallest gaps is the cheapest way to lose n ranges; a filled gap can
+ *  split into more or fewer networks, so the count is kept exact as the
+ *  neighbouring groups of ranges join. Only the fills up to the fewest
+ *  networks seen are kept, those after it would merely add addresses.
+ *  Return the addresses added, or -ENOMEM with nothing changed.
+ */
+static int64_t salist_reduce(struct sa_open_data *od, size_t target)
+{
+	struct ipv4_range *r = od->tmp_base;
+	struct ipv4_gap *gaps;
+	size_t *parent, *last, nr_nets = 0, best_nets, nr_fills = 0, i, wi;
+	unsigned *nets;
+	uint64_t added = 0;
+
+	if (od->tmp_length < 2)
+		return 0;
+	gaps = malloc(sizeof(*gaps) * (od->tmp_length - 1));
+	parent = malloc(sizeof(size_t) * od->tmp_length * 2);
+	nets = malloc(sizeof(unsigned) * od->tmp_length);
+	if (!gaps || !parent || !nets) {
+		free(gaps);
+		free(parent);
+		free(nets);
+		return -ENOMEM;
+	}
+	last = parent + od->tmp_length;
+
+	for (i = 0; i < od->tmp_length; i++) {
+		parent[i] = last[i] = i;
+		nets[i] = ipv4_range_nets(r[i].start, r[i].end);
+		nr_nets += nets[i];
+		if (i + 1 < od->tmp_length) {
+			gaps[i].size = r[i + 1].start - r[i].end - 1;
+			gaps[i].index = i;
+		}
+	}
+	qsort(gaps, od->tmp_length - 1, sizeof(*gaps), ipv4_gap_sort_cmp);
+
+	/* A group of ranges is kept at its leftmost one, up to 'last' */
+	best_nets = nr_nets;
+	for (i = 0; i < od->tmp_length - 1 && best_nets > target; i++) {
+		size_t a = group_find(parent, gaps[i].index);
+		size_t b = group_find(parent, gaps[i].index + 1);
+
+		nr_nets -= nets[a] + nets[b];
+		parent[b] = a;
+		last[a] = last[b];
+		nets[a] = ipv4_range_nets(r[a].start, r[last[a]].end);
+		nr_nets += nets[a];
+		if (nr_nets < best_nets) {
+			best_nets = nr_nets;
+			nr_fills = i + 1;
+		}
+	}
+
+	/* Join again with only the fills that got there */
+	for (i = 0; i < od->tmp_length; i++)
+		parent[i] = last[i] = i;
+	for (i = 0; i < nr_fills; i++) {
+		size_t a = group_find(parent, gaps[i].index);
+		size_t b = group_find(parent, gaps[i].index + 1);
+
+		parent[b] = a;
+		last[a] = last[b];
+		added += gaps[i].size;
+	}
+
+	for (i = 0, wi = 0; i < od->tmp_length; i++) {
+		if (parent[i] == i)
+			r[wi++] = (struct ipv4_range){ r[i].start, r[last[i]].end };
+	}
+	od->tmp_length = wi;
+
+	free(gaps);
+	free(parent);
+	free(nets);
+	return added;
+}
+
+enum input_format {
+	INPUT_AUTO = 0,   /* one network, range or address per line */
+	INPUT_APNIC,      /* delegated-apnic-latest */
+};
+
+enum output_format {
+	OUTPUT_RANGE = 0,
+	OUTPUT_CIDR,
+	OUTPUT_IPSET,
+	OUTPUT_SWAP,      /* ipset script: build a new set, then swap it in */
+	OUTPUT_TABLE,
+	OUTPUT_DIR,
+};
+
+/* One output set, e.g. all the networks of one country */
+struct sa_set {
+	char  country[4];
+	char *name;
 	struct sa_open_data *od;
-	char lbuf[128];
+	struct sa6_open_data *od6;   /* with '-6' */
+	size_t ranges_merged;        /* for '--stats' */
+};
+
+#define MAX_SETS 16
+
+static struct sa_set sets[MAX_SETS];
+static int nr_sets = 0;
+static int inet6 = 0;
+
+/* A whole input file, memory mapped when possible */
+struct input_buf {
+	char  *data;
+	size_t len;
+	int    mapped;
+};
+
+static int input_buf_open(struct input_buf *ib, const char *path)
+{
+	struct stat st;
+	int fd;
+
+	memset(ib, 0, sizeof(*ib));
+
+	if (strcmp(path, "-") == 0) {
+		fd = STDIN_FILENO;
+	} else if ((fd = open(path, O_RDONLY)) < 0) {
+		fprintf(stderr, "Cannot open '%s': %s.\n", path, strerror(errno));
+		return -errno;
+	}
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		ib->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (ib->data != MAP_FAILED) {
+			madvise(ib->data, st.st_size, MADV_SEQUENTIAL);
+			ib->len = st.st_size;
+			ib->mapped = 1;
+			goto out;
+		}
+		ib->data = NULL;
+	}
+
+	/* Pipes and such: read everything into memory */
+	for (;;) {
+		size_t size = ib->len ? ib->len * 2 : 65536;
+		char *data;
+		ssize_t rc;
+
+		if (!(data = realloc(ib->data, size))) {
+			fprintf(stderr, "Cannot allocate memory for '%s'.\n", path);
+			free(ib->data);
+			ib->data = NULL;
+			break;
+		}
+		ib->data = data;
+		while (ib->len < size) {
+			if ((rc = read(fd, ib->data + ib->len, size - ib->len)) < 0) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			if (rc == 0)
+				break;
+			ib->len += rc;
+		}
+		if (ib->len < size)
+			break;
+	}
+
+out:
+	if (fd != STDIN_FILENO)
+		close(fd);
+	return ib->data || ib->len == 0 ? 0 : -ENOMEM;
+}
+
+static void input_buf_close(struct input_buf *ib)
+{
+	if (ib->mapped)
+		munmap(ib->data, ib->len);
+	else
+		free(ib->data);
+	ib->data = NULL;
+	ib->len = 0;
+}
 
-	od = salist_open();
+/**
+ * Scan an APNIC delegated file once and hand the IPv4 records of every
+ *  wanted country to its own list, e.g.:
+ *   apnic|CN|ipv4|1.0.1.0|256|20110414|allocated
+ * The address count is not always a power of 2, so each record is kept
+ *  as an exact range and covered by networks on output.
+ * With 'ods6', the IPv6 records are taken instead, whose value is the
+ *  prefix length:
+ *   apnic|CN|ipv6|2001:250::|35|20000426|allocated
+ */
+static int salist_load_apnic(struct sa_open_data **ods,
+		struct sa6_open_data **ods6, const char *path)
+{
+	struct input_buf ib;
+	const char *p, *end, *eol;
+	size_t lines = 0;
+	int ret;
+
+	if ((ret = input_buf_open(&ib, path)) < 0)
+		return ret;
+
+	for (p = ib.data, end = ib.data + ib.len; p < end; p = eol + 1) {
+		const char *fields[6];
+		size_t flen[5];
+		uint32_t start, count;
+		int i, si;
+
+		if (!(eol = memchr(p, '\n', end - p)))
+			eol = end;
+		lines++;
+		if (*p == '#')
+			continue;
+
+		/* registry|cc|type|start|value|... */
+		fields[0] = p;
+		for (i = 0; i < 5; i++) {
+			const char *sep = memchr(fields[i], '|', eol - fields[i]);
+			if (!sep)
+				break;
+			flen[i] = sep - fields[i];
+			fields[i + 1] = sep + 1;
+		}
+		if (i < 5 || flen[2] != 4 ||
+			memcmp(fields[2], ods6 ? "ipv6" : "ipv4", 4))
+			continue;
+
+		for (si = 0; si < nr_sets; si++) {
+			if (strlen(sets[si].country) == flen[1] &&
+				memcmp(sets[si].country, fields[1], flen[1]) == 0)
+				break;
+		}
+		if (si >= nr_sets)
+			continue;
+
+		if (ods6) {
+			struct ipv6_addr net;
+			for (count = 0, i = 0; i < flen[4] && i < 3 &&
+				fields[4][i] >= '0' && fields[4][i] <= '9'; i++)
+				count = count * 10 + (fields[4][i] - '0');
+			if (ipv6_parse_n(fields[3], flen[3], &net) < 0 || i == 0 ||
+				i != flen[4] || count > 128) {
+				fprintf(stderr, "Invalid APNIC record '%.*s'.\n", (int)(eol - p), p);
+				ods6[si]->errors++;
+				continue;
+			}
+			if ((ret = ipv6_list_add_net(ods6[si], &net, count)) < 0)
+				break;
+			continue;
+		}
 
-	while (fgets(lbuf, sizeof(lbuf), stdin)) {
-		size_t llen = strlen(lbuf);
-		if (llen > 0 && lbuf[llen - 1] == '\n')
-			lbuf[--llen] = '\0';
-		if (llen > 0 && lbuf[llen - 1] == '\r')
-			lbuf[--llen] = '\0';
-		if (llen == 0)
+		for (count = 0, i = 0; i < flen[4] && fields[4][i] >= '0' && fields[4][i] <= '9'; i++)
+			count = count * 10 + (fields[4][i] - '0');
+		if (ipv4_parse_n(fields[3], flen[3], &start) < 0 || i != flen[4] ||
+			count == 0 || count - 1 > 0xffffffff - start) {
+			fprintf(stderr, "Invalid APNIC record '%.*s'.\n", (int)(eol - p), p);
+			ods[si]->errors++;
 			continue;
-		salist_cmd_parse(od, lbuf, 0);
+		}
+		if ((ret = ipv4_list_add_range(ods[si], start, start + (count - 1), 0)) < 0)
+			break;
+		ods[si]->entries++;
 	}
 
-	salist_close(od);
+	/* The lines of the file count once, with the first set */
+	if (ods)
+		ods[0]->lines += lines;
+	input_buf_close(&ib);
+	return ret < 0 ? ret : 0;
+}
 
-	sa_open_data_dump(od);
+/**
+ * Parse a buffer of entries, one per line. Lines of ipset restore files
+ *  give "add <set> <entry>", their "create" lines are skipped, and so are
+ *  empty lines and '#' comments. Return 0, or the error of storing an
+ *  entry (-ENOMEM, or a failed spill), invalid entries only count in
+ *  'od->errors'.
+ */
+static int salist_parse_buf(struct sa_open_data *od, const char *data, size_t len)
+{
+	const char *p, *end = data + len, *eol, *e;
+	int ret;
 
+	for (p = data; p < end; p = eol + 1) {
+		if (!(eol = memchr(p, '\n', end - p)))
+			eol = end;
+		od->lines++;
+		for (; p < eol && (*p == ' ' || *p == '\t'); p++)
+			;
+		for (e = eol; e > p && (e[-1] == '\r' || e[-1] == ' ' || e[-1] == '\t'); e--)
+			;
+		if (p == e || *p == '#')
+			continue;
+		if (*p == 'c' && e - p >= 7 && memcmp(p, "create ", 7) == 0)
+			continue;
+		if (*p == 'a' && e - p >= 4 && memcmp(p, "add ", 4) == 0) {
+			const char *entry = memchr(p + 4, ' ', e - p - 4);
+			if (entry)
+				p = entry + 1;
+		}
+		if ((ret = salist_cmd_parse_n(od, p, e - p)) == 0)
+			od->entries++;
+		else if (ret != -EINVAL)
+			return ret;
+	}
 	return 0;
 }
 
+#define STREAM_BUF_SIZE (256 * 1024)
+
+/**
+ * Streaming mode: parse the file in chunks of whole lines instead of
+ *  mapping or reading all of it, so that only the ranges take memory;
+ *  'parse' gets each chunk with 'od', an IPv4 or an IPv6 list.
+ */
+static int stream_file(const char *path, int (*parse)(void *, const char *, size_t),
+		void *od)
+{
+	size_t len = 0, n;
+	int fd, skip = 0, ret = 0;
+	ssize_t rc;
+	char *buf;
+
+	if (strcmp(path, "-") == 0) {
+		fd = STDIN_FILENO;
+	} else if ((fd = open(path, O_RDONLY)) < 0) {
+		fprintf(stderr, "Cannot open '%s': %s.\n", path, strerror(errno));
+		return -errno;
+	}
+	if (!(buf = malloc(STREAM_BUF_SIZE))) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	for (;;) {
+		if ((rc = read(fd, buf + len, STREAM_BUF_SIZE - len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Cannot read '%s': %s.\n", path, strerror(errno));
+			ret = -errno;
+			break;
+		}
+		if (rc == 0) {
+			if (!skip)
+				ret = parse(od, buf, len);
+			break;
+		}
+		len += rc;
+
+		/* Parse up to the last complete line, keep the rest */
+		for (n = len; n > 0 && buf[n - 1] != '\n'; n--)
+			;
+		if (n == 0) {
+			if (len < STREAM_BUF_SIZE)
+				continue;
+			/* No line is that long, count it once and drop the rest of it */
+			if (!skip)
+				parse(od, buf, len);
+			skip = 1;
+			len = 0;
+			continue;
+		}
+		if (skip) {
+			char *eol = memchr(buf, '\n', n);
+			ret = parse(od, eol + 1, buf + n - eol - 1);
+			skip = 0;
+		} else {
+			ret = parse(od, buf, n);
+		}
+		if (ret < 0)
+			break;
+		memmove(buf, buf + n, len - n);
+		len -= n;
+	}
+	free(buf);
+
+out:
+	if (fd != STDIN_FILENO)
+		close(fd);
+	return ret;
+}
+
+static int salist_parse_chunk(void *od, const char *data, size_t len)
+{
+	return salist_parse_buf(od, data, len);
+}
+
+static int salist6_parse_chunk(void *od, const char *data, size_t len)
+{
+	return salist6_parse_buf(od, data, len);
+}
+
+static int salist_load_file(struct sa_open_data *od, const char *path)
+{
+	struct input_buf ib;
+	int ret;
+
+	if (od->max_size)
+		return stream_file(path, salist_parse_chunk, od);
+	if ((ret = input_buf_open(&ib, path)) < 0)
+		return ret;
+	ret = salist_parse_buf(od, ib.data, ib.len);
+	input_buf_close(&ib);
+	return ret;
+}
+
+/**
+ * Leave out the networks longer than /max_bits from the merged ranges
+ *  of 'od', in place. The networks that cover a range grow and then
+ *  shrink, so the ones kept of each range make a single range.
+ */
+static void salist_filter(struct sa_open_data *od, int max_bits)
+{
+	size_t i, n = 0;
+
+	if (max_bits >= 32)
+		return;
+	for (i = 0; i < od->tmp_length; i++) {
+		uint32_t net = od->tmp_base[i].start, end = od->tmp_base[i].end;
+		int kept = 0;
+		for (;;) {
+			int bits = ipv4_net_bits(net, end);
+			uint32_t last = ipv4_net_last(net, bits);
+			if (bits <= max_bits) {
+				if (!kept)
+					od->tmp_base[n].start = net;
+				od->tmp_base[n].end = last;
+				kept = 1;
+			}
+			if (last >= end)
+				break;
+			net = last + 1;
+		}
+		n += kept;
+	}
+	od->tmp_length = n;
+}
+
+/* Named input files, the operands of a set expression */
+struct sa_operand {
+	char *name;
+	struct sa_open_data *ods[MAX_SETS];
+};
+
+#define MAX_OPERANDS 32
+
+static struct sa_operand operands[MAX_OPERANDS];
+static int nr_operands = 0;
+
+/**
+ * One input file, parsed on its own by a worker of the pool. The result
+ *  is a sorted list for every set: an APNIC file is split by country in
+ *  a single scan, any other file goes to all of them (as one list).
+ */
+struct sa_job {
+	const char *path;
+	enum input_format format;
+	int max_bits;
+	struct sa_operand *operand;   /* named file for '-e', or NULL */
+	struct sa_open_data *res[MAX_SETS];
+	int ret;
+	/* For '--stats' */
+	size_t lines, errors, entries[MAX_SETS];
+};
+
+#define MAX_JOBS 64
+
+static struct sa_job jobs[MAX_JOBS];
+static int nr_jobs = 0;
+static int next_job = 0;
+
+static int sets_parse_file(struct sa_job *job)
+{
+	struct sa_open_data *srcs[MAX_SETS];
+	int nr = job->format == INPUT_APNIC ? nr_sets : 1, i, ret = 0;
+	double t;
+
+	for (i = 0; i < nr; i++) {
+		if (!(srcs[i] = salist_open()))
+			return -ENOMEM;
+		srcs[i]->max_size = run_size;
+	}
+	t = now_sec();
+	if (job->format == INPUT_APNIC)
+		ret = salist_load_apnic(srcs, NULL, job->path);
+	else
+		ret = salist_load_file(srcs[0], job->path);
+	phase_add(PHASE_PARSE, t);
+
+	/* Each file is merged and filtered on its own, in place, which keeps it sorted */
+	for (i = 0; i < nr; i++) {
+		int r;
+
+		job->lines += srcs[i]->lines;
+		job->errors += srcs[i]->errors;
+		job->entries[i] = srcs[i]->entries;
+		r = salist_close(srcs[i]);
+		if (ret == 0)
+			ret = r;
+		salist_filter(srcs[i], job->max_bits);
+		/* Counted once, and no more spills */
+		srcs[i]->errors = 0;
+		srcs[i]->max_size = 0;
+		job->res[i] = srcs[i];
+	}
+	for (; i < nr_sets; i++) {
+		job->res[i] = job->res[0];
+		job->entries[i] = job->entries[0];
+	}
+	return ret;
+}
+
+static void *sets_parse_worker(void *arg)
+{
+	int i;
+
+	while ((i = __sync_fetch_and_add(&next_job, 1)) < nr_jobs)
+		jobs[i].ret = sets_parse_file(&jobs[i]);
+	return NULL;
+}
+
+/* Parse all queued files on up to 'nr_threads' threads */
+static int sets_parse_all(int nr_threads)
+{
+	pthread_t threads[64];
+	int i, n = 0;
+
+	if (nr_threads > nr_jobs)
+		nr_threads = nr_jobs;
+	if (nr_threads > 64)
+		nr_threads = 64;
+	/* The calling thread is one of the workers */
+	for (i = 1; i < nr_threads; i++) {
+		if (pthread_create(&threads[n], NULL, sets_parse_worker, NULL) == 0)
+			n++;
+	}
+	sets_parse_worker(NULL);
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < nr_jobs; i++) {
+		if (jobs[i].ret < 0)
+			return jobs[i].ret;
+	}
+	return 0;
+}
+
+/**
+ * Merge the sorted lists 'srcs' into the empty list 'od' at once, always
+ *  taking the lowest head of them, so that 'od' comes out sorted and
+ *  merged. With 'take', the lists are used up instead of copied: the
+ *  largest one is moved to the end of its array, grown to the total, and
+ *  the merge fills that array from the start, which never overtakes the
+ *  next range of the list; the others are freed as soon as they run out.
+ */
+static int salist_merge_sorted(struct sa_open_data *od, struct sa_open_data **srcs,
+		int nr, int take)
+{
+	struct ipv4_range *bases[MAX_JOBS], *base;
+	size_t pos[MAX_JOBS], ends[MAX_JOBS], total = 0, n = 0;
+	double t = now_sec();
+	int k, big = 0;
+
+	for (k = 0; k < nr; k++) {
+		bases[k] = srcs[k]->tmp_base;
+		pos[k] = 0;
+		ends[k] = srcs[k]->tmp_length;
+		total += srcs[k]->tmp_length;
+		if (srcs[k]->tmp_length > srcs[big]->tmp_length)
+			big = k;
+	}
+
+	if (take && nr) {
+		if (!(base = realloc(bases[big], sizeof(struct ipv4_range) * (total + 1))))
+			return -ENOMEM;
+		pos[big] = total - ends[big];
+		memmove(base + pos[big], base, sizeof(struct ipv4_range) * ends[big]);
+		ends[big] = total;
+		bases[big] = base;
+		srcs[big]->tmp_base = NULL;
+		srcs[big]->tmp_size = srcs[big]->tmp_length = 0;
+	} else if (!(base = malloc(sizeof(struct ipv4_range) * (total + 1)))) {
+		return -ENOMEM;
+	}
+
+	for (;;) {
+		struct ipv4_range r;
+		int min = -1;
+
+		for (k = 0; k < nr; k++) {
+			if (pos[k] < ends[k] && (min < 0 ||
+				bases[k][pos[k]].start < bases[min][pos[min]].start))
+				min = k;
+		}
+		if (min < 0)
+			break;
+		r = bases[min][pos[min]++];
+		if (n && (uint64_t)r.start <= (uint64_t)base[n - 1].end + 1) {
+			if (r.end > base[n - 1].end)
+				base[n - 1].end = r.end;
+		} else {
+			base[n++] = r;
+		}
+		if (take && min != big && pos[min] >= ends[min]) {
+			free(srcs[min]->tmp_base);
+			srcs[min]->tmp_base = NULL;
+			srcs[min]->tmp_size = srcs[min]->tmp_length = 0;
+		}
+	}
+
+	free(od->tmp_base);
+	od->tmp_base = base;
+	od->tmp_size = total + 1;
+	od->tmp_length = n;
+	phase_add(PHASE_MERGE, t);
+	return 0;
+}
+
+/* Hand the parsed files to their sets or to the named files for '-e' */
+static int sets_collect(void)
+{
+	struct sa_open_data *srcs[MAX_JOBS];
+	int i, j, nr, shared, ret;
+
+	for (j = 0; j < nr_jobs; j++) {
+		if (!jobs[j].operand)
+			continue;
+		for (i = 0; i < nr_sets; i++) {
+			jobs[j].operand->ods[i] = jobs[j].res[i];
+			if (i == 0 || jobs[j].format == INPUT_APNIC)
+				salist_close(jobs[j].res[i]);
+		}
+	}
+
+	/* A list of a file other than APNIC ones is all the sets', the last one takes it */
+	for (i = 0; i < nr_sets; i++) {
+		for (j = 0, nr = 0, shared = 0; j < nr_jobs; j++) {
+			if (jobs[j].operand)
+				continue;
+			srcs[nr++] = jobs[j].res[i];
+			if (jobs[j].format != INPUT_APNIC)
+				shared = 1;
+		}
+		if ((ret = salist_merge_sorted(sets[i].od, srcs, nr,
+				!shared || i == nr_sets - 1)) < 0)
+			return ret;
+	}
+	for (j = 0; j < nr_jobs; j++) {
+		if (jobs[j].operand)
+			continue;
+		for (i = 0; i < nr_sets; i++) {
+			if (i == 0 || jobs[j].format == INPUT_APNIC)
+				salist_free(jobs[j].res[i]);
+		}
+	}
+	return 0;
+}
+
+/* sets_parse_file() for the IPv6 lists, one file at a time */
+static int sets6_load_file(const char *path, enum input_format format,
+		int max_bits)
+{
+	struct sa6_open_data *srcs[MAX_SETS];
+	int i, ret;
+
+	if (format == INPUT_APNIC) {
+		for (i = 0; i < nr_sets; i++) {
+			if (!(srcs[i] = salist6_open()))
+				return -ENOMEM;
+		}
+		ret = salist_load_apnic(NULL, srcs, path);
+		for (i = 0; i < nr_sets; i++)
+			salist6_close(srcs[i]);
+	} else {
+		if (!(srcs[0] = salist6_open()))
+			return -ENOMEM;
+		ret = stream_file(path, salist6_parse_chunk, srcs[0]);
+		salist6_close(srcs[0]);
+		for (i = 1; i < nr_sets; i++)
+			srcs[i] = srcs[0];
+	}
+
+	/* With no length left out, the last user of a list takes it as it is */
+	for (i = 0; i < nr_sets && ret == 0; i++) {
+		if (max_bits >= 128 && (format == INPUT_APNIC || i == nr_sets - 1))
+			ret = salist6_move(sets[i].od6, srcs[i]);
+		else
+			ret = salist6_add_filtered(sets[i].od6, srcs[i], max_bits);
+	}
+
+	for (i = 0; i < nr_sets; i++) {
+		if (i == 0 || format == INPUT_APNIC)
+			salist6_free(srcs[i]);
+	}
+	return ret;
+}
+
+static int sets_init(char *countries, char *names)
+{
+	char *cc, *name, *cc_next = NULL, *name_next = NULL;
+
+	for (cc = strtok_r(countries, ",", &cc_next),
+		 name = names ? strtok_r(names, ",", &name_next) : NULL; cc;
+		 cc = strtok_r(NULL, ",", &cc_next),
+		 name = name ? strtok_r(NULL, ",", &name_next) : NULL) {
+		struct sa_set *set = &sets[nr_sets];
+
+		if (nr_sets >= MAX_SETS) {
+			fprintf(stderr, "*** Too many countries, at most %d.\n", MAX_SETS);
+			return -EINVAL;
+		}
+		if (strlen(cc) >= sizeof(set->country)) {
+			fprintf(stderr, "*** Invalid country code '%s'.\n", cc);
+			return -EINVAL;
+		}
+		strcpy(set->country, cc);
+		if (name) {
+			set->name = name;
+		} else {
+			/* Default set names: 'china' for CN alone, or lowercase codes */
+			size_t j;
+			set->name = strdup(cc);
+			for (j = 0; set->name[j]; j++)
+				set->name[j] = tolower(set->name[j]);
+		}
+		if (!(set->od = salist_open()))
+			return -ENOMEM;
+		if (inet6 && !(set->od6 = salist6_open()))
+			return -ENOMEM;
+		nr_sets++;
+	}
+	if (nr_sets == 1 && !names && strcmp(sets[0].country, "CN") == 0)
+		sets[0].name = inet6 ? "china6" : "china";
+	return 0;
+}
+
+/**
+ * Replace the merged table with its complement over the whole address
+ *  space, 0.0.0.0 - 255.255.255.255, in one pass.
+ */
+static int salist_invert(struct sa_open_data *od)
+{
+	struct ipv4_range *inv;
+	size_t i, n = 0;
+	uint32_t next = 0;
+	int tail = 1;
+
+	inv = (struct ipv4_range *)malloc(sizeof(struct ipv4_range) * (od->tmp_length + 1));
+	if (!inv)
+		return -ENOMEM;
+
+	for (i = 0; i < od->tmp_length; i++) {
+		if (od->tmp_base[i].start > next) {
+			inv[n].start = next;
+			inv[n].end = od->tmp_base[i].start - 1;
+			n++;
+		}
+		/* NOTICE: 0xffffffff + 1 wraps, nothing is left after it */
+		if (od->tmp_base[i].end == (uint32_t)(-1)) {
+			tail = 0;
+			break;
+		}
+		next = od->tmp_base[i].end + 1;
+	}
+	if (tail) {
+		inv[n].start = next;
+		inv[n].end = (uint32_t)(-1);
+		n++;
+	}
+
+	free(od->tmp_base);
+	od->tmp_base = inv;
+	od->tmp_size = od->tmp_length + 1;
+	od->tmp_length = n;
+	return 0;
+}
+
+/**
+ * Set algebra over merged tables. All of them walk both sorted tables
+ *  once and produce a new merged table.
+ */
+static int salist_append(struct sa_open_data *od, uint32_t start, uint32_t end)
+{
+	struct ipv4_range *last;
+
+	/* Join with the previous range if they overlap or touch */
+	if (od->tmp_length) {
+		last = &od->tmp_base[od->tmp_length - 1];
+		if (last->end == (uint32_t)(-1) || start <= last->end + 1) {
+			if (end > last->end)
+				last->end = end;
+			return 0;
+		}
+	}
+	return ipv4_list_add_range(od, start, end, 0);
+}
+
+static struct sa_open_data *salist_union(struct sa_open_data *a,
+		struct sa_open_data *b)
+{
+	struct sa_open_data *od = salist_open();
+	size_t i = 0, j = 0;
+
+	while (od && (i < a->tmp_length || j < b->tmp_length)) {
+		struct ipv4_range *r;
+		if (j >= b->tmp_length || (i < a->tmp_length &&
+			a->tmp_base[i].start <= b->tmp_base[j].start))
+			r = &a->tmp_base[i++];
+		else
+			r = &b->tmp_base[j++];
+		if (salist_append(od, r->start, r->end) < 0) {
+			salist_free(od);
+			return NULL;
+		}
+	}
+	return od;
+}
+
+static struct sa_open_data *salist_intersect(struct sa_open_data *a,
+		struct sa_open_data *b)
+{
+	struct sa_open_data *od = salist_open();
+	size_t i = 0, j = 0;
+
+	while (od && i < a->tmp_length && j < b->tmp_length) {
+		struct ipv4_range *ra = &a->tmp_base[i], *rb = &b->tmp_base[j];
+		uint32_t start = ra->start > rb->start ? ra->start : rb->start;
+		uint32_t end = ra->end < rb->end ? ra->end : rb->end;
+
+		if (start <= end && salist_append(od, start, end) < 0) {
+			salist_free(od);
+			return NULL;
+		}
+		/* Drop whichever ends first, the other may overlap further */
+		if (ra->end < rb->end)
+			i++;
+		else
+			j++;
+	}
+	return od;
+}
+
+static struct sa_open_data *salist_subtract(struct sa_open_data *a,
+		struct sa_open_data *b)
+{
+	struct sa_open_data *od = salist_open();
+	size_t i, j = 0;
+
+	for (i = 0; od && i < a->tmp_length; i++) {
+		uint32_t start = a->tmp_base[i].start, end = a->tmp_base[i].end;
+		int left = 1;
+
+		/* Skip ranges of 'b' that end before this one */
+		while (j < b->tmp_length && b->tmp_base[j].end < start)
+			j++;
+		while (left && j < b->tmp_length && b->tmp_base[j].start <= end) {
+			struct ipv4_range *rb = &b->tmp_base[j];
+			if (rb->start > start && salist_append(od, start, rb->start - 1) < 0)
+				goto fail;
+			if (rb->end >= end) {
+				/* Keep 'rb', it may cut the next range as well */
+				left = 0;
+			} else {
+				start = rb->end + 1;
+				j++;
+			}
+		}
+		if (left && salist_append(od, start, end) < 0)
+			goto fail;
+	}
+	return od;
+
+fail:
+	salist_free(od);
+	return NULL;
+}
+
+static struct sa_open_data *salist_copy(struct sa_open_data *src)
+{
+	struct sa_open_data *od = salist_open();
+	size_t i;
+
+	for (i = 0; od && i < src->tmp_length; i++) {
+		if (ipv4_list_add_range(od, src->tmp_base[i].start,
+			src->tmp_base[i].end, 0) < 0) {
+			salist_free(od);
+			return NULL;
+		}
+	}
+	return od;
+}
+
+/* Named input files, the operands of a set expression */
+/**
+ * Expression grammar, '&' binds tighter than '|' and '-':
+ *  expr   := term { ('|' | '+' | '-') term }
+ *  term   := factor { '&' factor }
+ *  factor := name | '(' expr ')'
+ */
+struct expr_ctx {
+	const char *p;
+	int set;
+};
+
+static struct sa_open_data *expr_eval(struct expr_ctx *ctx);
+
+static void expr_skip_space(struct expr_ctx *ctx)
+{
+	while (*ctx->p == ' ' || *ctx->p == '\t')
+		ctx->p++;
+}
+
+static struct sa_open_data *expr_factor(struct expr_ctx *ctx)
+{
+	struct sa_open_data *od;
+	const char *name;
+	size_t len;
+	int i;
+
+	expr_skip_space(ctx);
+	if (*ctx->p == '(') {
+		ctx->p++;
+		if (!(od = expr_eval(ctx)))
+			return NULL;
+		expr_skip_space(ctx);
+		if (*ctx->p != ')') {
+			fprintf(stderr, "*** Missing ')' in expression at '%s'.\n", ctx->p);
+			salist_free(od);
+			return NULL;
+		}
+		ctx->p++;
+		return od;
+	}
+
+	for (name = ctx->p; isalnum(*ctx->p) || *ctx->p == '_'; ctx->p++)
+		;
+	if ((len = ctx->p - name) == 0) {
+		fprintf(stderr, "*** Expected a name in expression at '%s'.\n", name);
+		return NULL;
+	}
+	for (i = 0; i < nr_operands; i++) {
+		if (strlen(operands[i].name) == len &&
+			memcmp(operands[i].name, name, len) == 0)
+			return salist_copy(operands[i].ods[ctx->set]);
+	}
+	fprintf(stderr, "*** Unknown name '%.*s' in expression.\n", (int)len, name);
+	return NULL;
+}
+
+static struct sa_open_data *expr_term(struct expr_ctx *ctx)
+{
+	struct sa_open_data *od, *rhs, *res;
+
+	if (!(od = expr_factor(ctx)))
+		return NULL;
+	for (;;) {
+		expr_skip_space(ctx);
+		if (*ctx->p != '&')
+			return od;
+		ctx->p++;
+		if (!(rhs = expr_factor(ctx))) {
+			salist_free(od);
+			return NULL;
+		}
+		res = salist_intersect(od, rhs);
+		salist_free(od);
+		salist_free(rhs);
+		if (!(od = res))
+			return NULL;
+	}
+}
+
+static struct sa_open_data *expr_eval(struct expr_ctx *ctx)
+{
+	struct sa_open_data *od, *rhs, *res;
+	char op;
+
+	if (!(od = expr_term(ctx)))
+		return NULL;
+	for (;;) {
+		expr_skip_space(ctx);
+		op = *ctx->p;
+		if (op != '|' && op != '+' && op != '-')
+			return od;
+		ctx->p++;
+		if (!(rhs = expr_term(ctx))) {
+			salist_free(od);
+			return NULL;
+		}
+		res = op == '-' ? salist_subtract(od, rhs) : salist_union(od, rhs);
+		salist_free(od);
+		salist_free(rhs);
+		if (!(od = res))
+			return NULL;
+	}
+}
+
+static struct sa_open_data *salist_evaluate(const char *expr, int set)
+{
+	struct expr_ctx ctx = { expr, set };
+	struct sa_open_data *od;
+
+	if (!(od = expr_eval(&ctx)))
+		return NULL;
+	expr_skip_space(&ctx);
+	if (*ctx.p) {
+		fprintf(stderr, "*** Unexpected '%s' in expression.\n", ctx.p);
+		salist_free(od);
+		return NULL;
+	}
+	return od;
+}
+
+/* Count the networks by prefix length, 'hist' has 33 slots; return the total */
+static size_t salist_prefix_histogram(const struct sa_open_data *od, size_t *hist)
+{
+	size_t i, nr = 0;
+
+	memset(hist, 0, sizeof(size_t) * 33);
+	for (i = 0; i < od->tmp_length; i++) {
+		uint32_t net = od->tmp_base[i].start, end = od->tmp_base[i].end;
+		for (;;) {
+			int bits = ipv4_net_bits(net, end);
+			uint32_t last = ipv4_net_last(net, bits);
+			hist[bits]++;
+			nr++;
+			if (last >= end)
+				break;
+			net = last + 1;
+		}
+	}
+	return nr;
+}
+
+/**
+ * Print the networks per prefix length to stderr. A 'hash:net' set probes
+ *  its hash once per prefix length it holds, so the number of lengths is
+ *  the cost of a lookup that misses.
+ */
+static void print_prefix_histogram(const char *name, const size_t *hist, int max_bits)
+{
+	size_t nr = 0;
+	int bits, nr_lens = 0;
+
+	for (bits = 0; bits <= max_bits; bits++) {
+		nr += hist[bits];
+		nr_lens += hist[bits] != 0;
+	}
+	fprintf(stderr, "%s: %lu networks, %d prefix lengths (probes per lookup)\n",
+		name, (unsigned long)nr, nr_lens);
+	for (bits = 0; bits <= max_bits; bits++) {
+		if (hist[bits])
+			fprintf(stderr, "  /%-3d %8lu  %5.1f%%\n", bits, (unsigned long)hist[bits],
+				100.0 * hist[bits] / nr);
+	}
+}
+
+static void json_print_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(fp, "\\u%04x", *s);
+		else
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+/**
+ * '--stats': the input files and the sets made of them as one JSON
+ *  object, e.g.
+ *   {"files": [{"path": "ipip.txt", "lines": 8595, "parsed": 8595, "rejected": 0}],
+ *    "lines": 8595, "parsed": 8595, "rejected": 0,
+ *    "sets": [{"name": "china", "ranges_in": 8595, "ranges_merged": 3906,
+ *              "cidrs": 8595, "prefix_lengths": {"8": 1, ...}, "addresses": 343...}],
+ *    "time_ms": {"parse": 2.1, "sort": 0.4, "merge": 0.3, "emit": 1.2, "total": 5.0}}
+ * The phases add up the time of all threads, 'total' is the wall time.
+ */
+static void sets_print_stats(FILE *fp, double t_start)
+{
+	size_t lines = 0, parsed = 0, rejected = 0, hist[33], n;
+	int i, j, bits;
+
+	fprintf(fp, "{\"files\": [");
+	for (j = 0; j < nr_jobs; j++) {
+		size_t entries = jobs[j].entries[0];
+		if (jobs[j].format == INPUT_APNIC) {
+			for (i = 1; i < nr_sets; i++)
+				entries += jobs[j].entries[i];
+		}
+		fprintf(fp, "%s{\"path\": ", j ? ", " : "");
+		json_print_string(fp, jobs[j].path);
+		fprintf(fp, ", \"lines\": %lu, \"parsed\": %lu, \"rejected\": %lu}",
+			(unsigned long)jobs[j].lines, (unsigned long)entries,
+			(unsigned long)jobs[j].errors);
+		lines += jobs[j].lines;
+		parsed += entries;
+		rejected += jobs[j].errors;
+	}
+	fprintf(fp, "],\n \"lines\": %lu, \"parsed\": %lu, \"rejected\": %lu,\n \"sets\": [",
+		(unsigned long)lines, (unsigned long)parsed, (unsigned long)rejected);
+
+	for (i = 0; i < nr_sets; i++) {
+		struct sa_open_data *od = sets[i].od;
+		size_t ranges_in = 0, cidrs = salist_prefix_histogram(od, hist);
+		uint64_t covered = 0;
+		const char *sep = "";
+
+		for (j = 0; j < nr_jobs; j++)
+			ranges_in += jobs[j].entries[i];
+		for (n = 0; n < od->tmp_length; n++)
+			covered += (uint64_t)od->tmp_base[n].end - od->tmp_base[n].start + 1;
+		fprintf(fp, "%s{\"name\": ", i ? ",\n  " : "");
+		json_print_string(fp, sets[i].name);
+		fprintf(fp, ", \"ranges_in\": %lu, \"ranges_merged\": %lu, \"cidrs\": %lu, "
+			"\"prefix_lengths\": {", (unsigned long)ranges_in,
+			(unsigned long)sets[i].ranges_merged, (unsigned long)cidrs);
+		for (bits = 0; bits <= 32; bits++) {
+			if (hist[bits]) {
+				fprintf(fp, "%s\"%d\": %lu", sep, bits, (unsigned long)hist[bits]);
+				sep = ", ";
+			}
+		}
+		fprintf(fp, "}, \"addresses\": %llu}", (unsigned long long)covered);
+	}
+
+	fprintf(fp, "],\n \"time_ms\": {");
+	for (i = 0; i < NR_PHASES; i++)
+		fprintf(fp, "\"%s\": %.1f, ", phase_names[i], phase_us[i] / 1e3);
+	fprintf(fp, "\"total\": %.1f}}\n", (now_sec() - t_start) * 1e3);
+}
+
+static void sa_open_data_dump(struct sa_open_data *od,
+		enum output_format format, const char *set_name)
+{
+	size_t i, hist[33];
+	char s1[20], s2[20], new_name[64];
+	const char *add_to = set_name;
+	uint32_t hashsize = 0, maxelem = 0;
+
+	if (format == OUTPUT_IPSET || format == OUTPUT_SWAP)
+		ipset_hash_size(salist_prefix_histogram(od, hist), &hashsize, &maxelem);
+	if (format == OUTPUT_SWAP) {
+		/**
+		 * Fill "<name>-new" while the live set keeps working, then swap.
+		 *  One left over by a failed run may have other sizes, which
+		 *  'create -exist' refuses, so it goes first.
+		 */
+		snprintf(new_name, sizeof(new_name), "%s-new", set_name);
+		add_to = new_name;
+		printf("destroy %s -exist\n", add_to);
+		printf("create %s hash:net family inet hashsize %u maxelem %u\n",
+			add_to, hashsize, maxelem);
+	} else if (format == OUTPUT_IPSET) {
+		printf("create %s hash:net family inet hashsize %u maxelem %u\n",
+			set_name, hashsize, maxelem);
+	}
+
+	for (i = 0; i < od->tmp_length; i++) {
+		uint32_t net = od->tmp_base[i].start, end = od->tmp_base[i].end;
+
+		if (format == OUTPUT_RANGE) {
+			printf("%s-%s\n", ipv4_hltos(net, s1), ipv4_hltos(end, s2));
+			continue;
+		}
+		for (;;) {
+			int bits = ipv4_net_bits(net, end);
+			uint32_t last = ipv4_net_last(net, bits);
+			if (format == OUTPUT_IPSET || format == OUTPUT_SWAP)
+				printf("add %s %s/%d\n", add_to, ipv4_hltos(net, s1), bits);
+			else
+				printf("%s/%d\n", ipv4_hltos(net, s1), bits);
+			if (last >= end)
+				break;
+			net = last + 1;
+		}
+	}
+
+	if (format == OUTPUT_SWAP) {
+		printf("swap %s %s\n", add_to, set_name);
+		printf("destroy %s\n", add_to);
+	}
+}
+
+/**
+ * Split every range into the networks that make up the entries of a
+ *  'hash:net' set, sorted. Entries loaded from an ipset file as they are
+ *  (not merged) stay the same entries.
+ */
+static struct sa_open_data *salist_entries(struct sa_open_data *od)
+{
+	struct sa_open_data *ents;
+	size_t i;
+
+	if (!(ents = salist_open()))
+		return NULL;
+	for (i = 0; i < od->tmp_length; i++) {
+		uint32_t net = od->tmp_base[i].start, end = od->tmp_base[i].end;
+		for (;;) {
+			int bits = ipv4_net_bits(net, end);
+			uint32_t last = ipv4_net_last(net, bits);
+			if (ipv4_list_add_range(ents, net, last, 0) < 0) {
+				salist_free(ents);
+				return NULL;
+			}
+			if (last >= end)
+				break;
+			net = last + 1;
+		}
+	}
+	salist_sort(ents);
+	return ents;
+}
+
+/**
+ * Re-expand the networks of 'od' so that they use at most 'max_lens'
+ *  prefix lengths and, if 'budget', at most 'budget' networks, fewest
+ *  lengths first. A network only ever becomes longer, as the 2^n networks
+ *  of the next length kept, so the addresses covered stay the same.
+ *
+ * With c[l] networks of length l, and the lengths kept being L1 < L2 < ...,
+ *  every length between L(k-1) and L(k) goes to L(k) and costs
+ *  c[l] * 2^(L(k) - l) networks. The longest length is always kept, and
+ *  the choice of the others is a small dynamic programme over the lengths
+ *  in use: best[j][k] is the fewest networks for the lengths up to the
+ *  j-th one with k lengths kept, the j-th being one of them.
+ *  Return the expanded list, sorted but not merged, or NULL.
+ */
+static struct sa_open_data *salist_expand(struct sa_open_data *od, int max_lens,
+		uint64_t budget, int *nr_lens)
+{
+	uint64_t best[33][34], cost;
+	int from[33][34], lens[33], target[33], m = 0, i, j, k, t, bits;
+	struct sa_open_data *ents, *out;
+	size_t hist[33], n;
+
+	salist_prefix_histogram(od, hist);
+	for (bits = 0; bits <= 32; bits++) {
+		if (hist[bits])
+			lens[m++] = bits;
+	}
+	if (!(out = salist_open()))
+		return NULL;
+	if (m == 0) {
+		*nr_lens = 0;
+		return out;
+	}
+
+	for (j = 0; j < m; j++) {
+		for (k = 0; k <= m; k++)
+			best[j][k] = UINT64_MAX;
+		/* Lengths up to the j-th all going to it */
+		for (cost = 0, t = 0; t <= j; t++)
+			cost += (uint64_t)hist[lens[t]] << (lens[j] - lens[t]);
+		best[j][1] = cost;
+		from[j][1] = -1;
+		for (k = 2; k <= j + 1; k++) {
+			for (i = 0; i < j; i++) {
+				if (best[i][k - 1] == UINT64_MAX)
+					continue;
+				for (cost = best[i][k - 1], t = i + 1; t <= j; t++)
+					cost += (uint64_t)hist[lens[t]] << (lens[j] - lens[t]);
+				if (cost < best[j][k]) {
+					best[j][k] = cost;
+					from[j][k] = i;
+				}
+			}
+		}
+	}
+
+	/* Fewest lengths that fit, the most allowed if nothing does */
+	if (max_lens <= 0 || max_lens > m)
+		max_lens = m;
+	for (k = 1; k < max_lens; k++) {
+		if (budget && best[m - 1][k] <= budget)
+			break;
+	}
+	*nr_lens = k;
+
+	/* Map every length to the next one kept */
+	for (j = m - 1; k >= 1; k--) {
+		int prev = k > 1 ? from[j][k] : -1;
+		for (t = prev + 1; t <= j; t++)
+			target[lens[t]] = lens[j];
+		j = prev;
+	}
+
+	if (!(ents = salist_entries(od))) {
+		salist_free(out);
+		return NULL;
+	}
+	for (n = 0; n < ents->tmp_length; n++) {
+		uint32_t net = ents->tmp_base[n].start, end = ents->tmp_base[n].end;
+		int to = target[ipv4_net_bits(net, end)];
+		for (;;) {
+			uint32_t last = ipv4_net_last(net, to);
+			if (ipv4_list_add_range(out, net, last, 0) < 0) {
+				salist_free(ents);
+				salist_free(out);
+				return NULL;
+			}
+			if (last >= end)
+				break;
+			net = last + 1;
+		}
+	}
+	salist_free(ents);
+	return out;
+}
+
+/**
+ * Print the entries to add to and to delete from the set loaded from
+ *  'old_path' to make it 'od', walking both sorted entry lists at once.
+ *  All additions come first, so nothing in both is ever missing from the
+ *  live set.
+ */
+static int sa_open_data_dump_diff(struct sa_open_data *od, const char *old_path,
+		enum output_format format, const char *set_name)
+{
+	struct sa_open_data *old_od, *a, *b;
+	size_t nr_add = 0, nr_del = 0, nr_keep = 0;
+	char s1[20];
+	int pass, ret;
+
+	if (!(old_od = salist_open()))
+		return -ENOMEM;
+	if ((ret = salist_load_file(old_od, old_path)) < 0) {
+		salist_free(old_od);
+		return ret;
+	}
+	a = salist_entries(old_od);
+	b = salist_entries(od);
+	salist_free(old_od);
+	if (!a || !b) {
+		if (a)
+			salist_free(a);
+		if (b)
+			salist_free(b);
+		return -ENOMEM;
+	}
+
+	for (pass = 0; pass < 2; pass++) {
+		size_t i = 0, j = 0;
+
+		while (i < a->tmp_length || j < b->tmp_length) {
+			struct ipv4_range *r;
+			int cmp, del;
+
+			if (i >= a->tmp_length)
+				cmp = 1;
+			else if (j >= b->tmp_length)
+				cmp = -1;
+			else
+				cmp = ipv4_range_sort_cmp(&a->tmp_base[i], &b->tmp_base[j]);
+
+			if (cmp == 0) {
+				/* Same entry on both sides, or a duplicate in the old file */
+				if (pass == 0)
+					nr_keep++;
+				i++;
+				j++;
+				while (i < a->tmp_length &&
+					ipv4_range_sort_cmp(&a->tmp_base[i], &b->tmp_base[j - 1]) == 0)
+					i++;
+				continue;
+			}
+			if (cmp < 0) {
+				r = &a->tmp_base[i++];
+				if (i < a->tmp_length && ipv4_range_sort_cmp(r, &a->tmp_base[i]) == 0)
+					continue;
+				del = 1;
+			} else {
+				r = &b->tmp_base[j++];
+				del = 0;
+			}
+			if (del != pass)
+				continue;
+			if (del)
+				nr_del++;
+			else
+				nr_add++;
+			if (format == OUTPUT_IPSET)
+				printf("%s %s %s/%d\n", del ? "del" : "add", set_name,
+					ipv4_hltos(r->start, s1), ipv4_net_bits(r->start, r->end));
+			else
+				printf("%c%s/%d\n", del ? '-' : '+',
+					ipv4_hltos(r->start, s1), ipv4_net_bits(r->start, r->end));
+		}
+	}
+
+	fprintf(stderr, "%s: %lu added, %lu deleted, %lu unchanged.\n", set_name,
+		(unsigned long)nr_add, (unsigned long)nr_del, (unsigned long)nr_keep);
+	salist_free(a);
+	salist_free(b);
+	return 0;
+}
+
+/* The sscanf() line parsing used before, as the baseline of '-b' */
+static int sscanf_parse_buf(struct sa_open_data *od, const char *data, size_t len)
+{
+	const char *p, *end = data + len, *eol;
+	char lbuf[128];
+	unsigned u[5];
+	int ret;
+
+	for (p = data; p < end; p = eol + 1) {
+		size_t llen;
+
+		if (!(eol = memchr(p, '\n', end - p)))
+			eol = end;
+		llen = eol - p < (long)sizeof(lbuf) - 1 ? (size_t)(eol - p) : sizeof(lbuf) - 1;
+		memcpy(lbuf, p, llen);
+		lbuf[llen] = '\0';
+		if (sscanf(lbuf, "%u.%u.%u.%u/%u", &u[0], &u[1], &u[2], &u[3], &u[4]) != 5) {
+			od->errors++;
+			continue;
+		}
+		if ((ret = ipv4_list_add_net(od, u[0] << 24 | u[1] << 16 | u[2] << 8 | u[3],
+				u[4], 0)) < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * Parse throughput of a file, or of 'arg' random networks, with the
+ *  strict parser and with sscanf(), and check that both agree.
+ */
+static int parse_bench(const char *arg)
+{
+	int (*parsers[2])(struct sa_open_data *, const char *, size_t) = {
+		salist_parse_buf, sscanf_parse_buf,
+	};
+	const char *names[2] = { "strict parser", "sscanf" };
+	struct sa_open_data *ods[2];
+	struct input_buf ib;
+	size_t lines = 0, i;
+	char *e;
+	int k;
+
+	memset(&ib, 0, sizeof(ib));
+	lines = strtoul(arg, &e, 10);
+	if (*e == '\0' && lines > 0) {
+		/* "a.b.c.d/len\n", random but repeatable */
+		uint64_t x = 0x9e3779b97f4a7c15ULL;
+		if (!(ib.data = malloc(lines * 19))) {
+			fprintf(stderr, "*** Out of memory.\n");
+			return -ENOMEM;
+		}
+		for (i = 0; i < lines; i++) {
+			uint32_t net;
+			int bits;
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			bits = 8 + (x >> 32) % 25;
+			net = (uint32_t)x & ~(uint32_t)(((uint64_t)1 << (32 - bits)) - 1);
+			ib.len += sprintf(ib.data + ib.len, "%u.%u.%u.%u/%d\n", net >> 24,
+				(net >> 16) & 0xff, (net >> 8) & 0xff, net & 0xff, bits);
+		}
+	} else {
+		if (input_buf_open(&ib, arg) < 0)
+			return -EINVAL;
+		for (i = 0, lines = 0; i < ib.len; i++)
+			lines += ib.data[i] == '\n';
+	}
+
+	for (k = 0; k < 2; k++) {
+		double t;
+		if (!(ods[k] = salist_open()))
+			return -ENOMEM;
+		ods[k]->tmp_size = lines + 1;
+		t = now_sec();
+		if (parsers[k](ods[k], ib.data, ib.len) < 0) {
+			fprintf(stderr, "*** Out of memory.\n");
+			return -ENOMEM;
+		}
+		t = now_sec() - t;
+		printf("%-14s %10lu lines %8.1f MB/s %8.2f M lines/s  (%d invalid)\n", names[k],
+			(unsigned long)lines, ib.len / t / 1e6, lines / t / 1e6, ods[k]->errors);
+		ods[k]->errors = 0;
+		salist_close(ods[k]);
+	}
+	if (ods[0]->tmp_length != ods[1]->tmp_length || memcmp(ods[0]->tmp_base,
+		ods[1]->tmp_base, sizeof(struct ipv4_range) * ods[0]->tmp_length)) {
+		fprintf(stderr, "*** The parsers disagree!\n");
+		return -EINVAL;
+	}
+	salist_free(ods[0]);
+	salist_free(ods[1]);
+	if (ib.mapped)
+		input_buf_close(&ib);
+	else
+		free(ib.data);
+	return 0;
+}
+
+/**
+ * Time qsort() against the radix sorts on random networks, from 256 up
+ *  to 'max' ranges, and show where radix sort starts to win.
+ */
+static int sort_bench(size_t max)
+{
+	static const char *names[3] = { "qsort", "radix", "radix-mt" };
+	struct ipv4_range *data, *work[3];
+	size_t n, crossover = 0;
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	int k;
+
+	data = malloc(sizeof(*data) * max);
+	for (k = 0; k < 3; k++)
+		work[k] = malloc(sizeof(*data) * max);
+	if (!data || !work[0] || !work[1] || !work[2]) {
+		fprintf(stderr, "*** Out of memory.\n");
+		return -ENOMEM;
+	}
+	for (n = 0; n < max; n++) {
+		int bits;
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		bits = 8 + (x >> 32) % 25;
+		data[n].start = (uint32_t)x & ~(uint32_t)(((uint64_t)1 << (32 - bits)) - 1);
+		data[n].end = ipv4_net_last(data[n].start, bits);
+	}
+
+	printf("%10s %12s %12s %12s   (ns per range, %d threads)\n", "ranges",
+		names[0], names[1], names[2], sort_threads);
+	for (n = 256; ; n = n * 2 > max && n < max ? max : n * 2) {
+		/* Small sizes are repeated to get past the clock resolution */
+		size_t rounds = n >= (1 << 22) ? 1 : (1 << 22) / n, i;
+		double t[3];
+
+		for (k = 0; k < 3; k++) {
+			double t0 = 0;
+			for (i = 0; i < rounds; i++) {
+				double ts;
+				memcpy(work[k], data, sizeof(*data) * n);
+				ts = now_sec();
+				if (k == 0)
+					ipv4_range_qsort(work[k], n);
+				else if (k == 1)
+					ipv4_range_radix_sort(work[k], n);
+				else
+					ipv4_range_radix_sort_mt(work[k], n, sort_threads);
+				t0 += now_sec() - ts;
+			}
+			t[k] = t0 / rounds;
+		}
+		if (memcmp(work[0], work[1], sizeof(*data) * n) ||
+			memcmp(work[0], work[2], sizeof(*data) * n)) {
+			fprintf(stderr, "*** Sort results disagree at %lu ranges!\n", (unsigned long)n);
+			return -EINVAL;
+		}
+		if (!crossover && t[1] < t[0])
+			crossover = n;
+		printf("%10lu %12.1f %12.1f %12.1f\n", (unsigned long)n,
+			t[0] * 1e9 / n, t[1] * 1e9 / n, t[2] * 1e9 / n);
+		if (n >= max)
+			break;
+	}
+	if (crossover)
+		printf("Radix sort is faster from %lu ranges on (qsort below %d in use).\n",
+			(unsigned long)crossover, RSORT_RADIX_MIN);
+
+	free(data);
+	for (k = 0; k < 3; k++)
+		free(work[k]);
+	return 0;
+}
+
+static void print_help(int argc, char *argv[])
+{
+	printf("Route list compiler: merges IPv4 (or IPv6) networks and ranges from several sources.\n");
+	printf("Usage:\n");
+	printf("  %s [options] [[-t format] file ...]\n", argv[0]);
+	printf("Options:\n");
+	printf("  -t <format>         format of the files that follow: 'auto' (default) or 'apnic'\n");
+	printf("  -C <cc>[,<cc>...]   countries picked from APNIC files, one set each (default: CN)\n");
+	printf("  -P <prefix_len>     drop networks longer than /prefix_len from each file\n");
+	printf("  -o <output>         output format: 'range' (default), 'cidr', 'ipset',\n");
+	printf("                      'swap' (ipset script that fills '<name>-new' and swaps\n");
+	printf("                      it in), or 'table' or 'dir' (binary range or DIR-16-8-8\n");
+	printf("                      table for 'iplookup', one set only)\n");
+	printf("  -n <name>[,<name>]  set names for '-o ipset' (default: china, or the country codes)\n");
+	printf("  -N <name>           name the following file for use in '-e'\n");
+	printf("  -e <expression>     build the sets from named files, e.g. 'apnic & ipip - local',\n");
+	printf("                      with '|' or '+' (union), '&' (intersection), '-' (difference)\n");
+	printf("  -I, --invert        output everything that is NOT in the sets\n");
+	printf("  -d, --diff <file>   output only the changes from the set in <file> (an ipset\n");
+	printf("                      file or list), as 'add'/'del' ipset commands with\n");
+	printf("                      '-o ipset', or '+'/'-' lines with '-o cidr'\n");
+	printf("  -g, --gap <n>       approximate: also merge ranges at most <n> addresses apart\n");
+	printf("  -T, --target <n>    approximate: fill the smallest gaps between ranges until\n");
+	printf("                      each set is at most <n> networks, fails if the gaps\n");
+	printf("                      cannot get it that low\n");
+	printf("                      (the exact number of addresses added goes to stderr)\n");
+	printf("  -j, --jobs <n>      parse the files on <n> threads (default: one per CPU)\n");
+	printf("  -s, --sort <method> 'auto' (default), 'qsort' or 'radix' (one thread),\n");
+	printf("                      to compare them\n");
+	printf("  -m, --memory <size> streaming mode: read the files in chunks and keep the\n");
+	printf("                      ranges of all of them within <size> MiB (or with a\n");
+	printf("                      K, M, G suffix), spilling sorted runs to $TMPDIR or\n");
+	printf("                      /tmp and merging them at the end; the peak RSS goes\n");
+	printf("                      to stderr\n");
+	printf("  -H, --histogram     print the networks per prefix length of each set to stderr\n");
+	printf("  -L, --prefix-lengths <n>\n");
+	printf("                      split networks into longer ones so that each set uses\n");
+	printf("                      at most <n> prefix lengths, i.e. hash probes per lookup\n");
+	printf("  -B, --budget <n>    with '-L', use the fewest prefix lengths that keep each\n");
+	printf("                      set within <n> networks ('-L 0' for no other limit)\n");
+	printf("  -6, --inet6         work on IPv6 networks ('range', 'cidr' and 'ipset' output,\n");
+	printf("                      default name: china6); the files are read in chunks\n");
+	printf("                      and radix-sorted in place, one at a time on one\n");
+	printf("                      thread; no '-I', '-e', '-L', '-g', '-T', '-m', '-s',\n");
+	printf("                      '--stats' or binary tables\n");
+	printf("  -b, --bench-parse <lines|file>\n");
+	printf("                      measure the parse throughput on a file, or on <lines>\n");
+	printf("                      random networks (only '/len' entries for sscanf)\n");
+	printf("  -S, --bench-sort <n>\n");
+	printf("                      time qsort() against radix sort on up to <n> ranges\n");
+	printf("  --stats[=<file>]    write the lines read, the ranges before and after the\n");
+	printf("                      merge, the networks per prefix length and the time of\n");
+	printf("                      each phase as JSON to <file> (default: stderr)\n");
+	printf("  -h, --help          print this help\n");
+	printf("Without any file, stdin is read. '-' stands for stdin as well.\n");
+	printf("Files other than APNIC ones are added to every set.\n");
+	printf("Example:\n");
+	printf("  %s -o cidr -N apnic -t apnic apnic.txt -N ipip -t auto ipip.txt -e 'apnic & ipip'\n", argv[0]);
+}
+
+/* Options with no short form */
+#define OPT_STATS   256
+
+int main(int argc, char *argv[])
+{
+	enum input_format in_format = INPUT_AUTO;
+	enum output_format out_format = OUTPUT_RANGE;
+	char *countries = "CN", *set_names = NULL, *operand_name = NULL, *expr = NULL;
+	char *diff_path = NULL, *stats_path = NULL, new_name[64];
+	const char *path;
+	int max_bits = -1, nr_files = 0, invert = 0, histogram = 0, max_lens = -1, opt, i;
+	int stats = 0;
+	double t_start = now_sec(), t;
+	unsigned long budget = 0, gap = 0, target = 0, memory = 0;
+	long nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	struct option longopts[] = {
+		{ "type", required_argument, NULL, 't', },
+		{ "country", required_argument, NULL, 'C', },
+		{ "max-prefix", required_argument, NULL, 'P', },
+		{ "output", required_argument, NULL, 'o', },
+		{ "name", required_argument, NULL, 'n', },
+		{ "invert", no_argument, NULL, 'I', },
+		{ "inet6", no_argument, NULL, '6', },
+		{ "diff", required_argument, NULL, 'd', },
+		{ "file-name", required_argument, NULL, 'N', },
+		{ "expression", required_argument, NULL, 'e', },
+		{ "jobs", required_argument, NULL, 'j', },
+		{ "memory", required_argument, NULL, 'm', },
+		{ "sort", required_argument, NULL, 's', },
+		{ "bench-parse", required_argument, NULL, 'b', },
+		{ "bench-sort", required_argument, NULL, 'S', },
+		{ "gap", required_argument, NULL, 'g', },
+		{ "target", required_argument, NULL, 'T', },
+		{ "histogram", no_argument, NULL, 'H', },
+		{ "prefix-lengths", required_argument, NULL, 'L', },
+		{ "budget", required_argument, NULL, 'B', },
+		{ "stats", optional_argument, NULL, OPT_STATS, },
+		{ "help", no_argument, NULL, 'h', },
+		{ NULL, 0, NULL, 0, },
+	};
+
+	sort_threads = nr_threads > 0 ? nr_threads : 1;
+
+	/* Options apply to the files following them, so stop at each file */
+	for (;;) {
+		while ((opt = getopt_long(argc, argv, "+t:C:P:o:n:N:e:d:Ij:m:s:g:T:HL:B:b:S:6h",
+				longopts, NULL)) != -1) {
+			switch (opt) {
+			case 't':
+				if (strcmp(optarg, "auto") == 0) {
+					in_format = INPUT_AUTO;
+				} else if (strcmp(optarg, "apnic") == 0) {
+					in_format = INPUT_APNIC;
+				} else {
+					fprintf(stderr, "*** Unknown input format '%s'.\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'C':
+			case 'n':
+			case '6':
+				if (nr_sets) {
+					fprintf(stderr, "*** '-%c' must come before any file.\n", opt);
+					exit(1);
+				}
+				if (opt == 'C')
+					countries = optarg;
+				else if (opt == 'n')
+					set_names = optarg;
+				else
+					inet6 = 1;
+				break;
+			case 'P':
+				max_bits = atoi(optarg);
+				if (max_bits < 0 || max_bits > 128) {
+					fprintf(stderr, "*** Invalid prefix length '%s'.\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'o':
+				if (strcmp(optarg, "range") == 0) {
+					out_format = OUTPUT_RANGE;
+				} else if (strcmp(optarg, "cidr") == 0) {
+					out_format = OUTPUT_CIDR;
+				} else if (strcmp(optarg, "ipset") == 0) {
+					out_format = OUTPUT_IPSET;
+				} else if (strcmp(optarg, "swap") == 0) {
+					out_format = OUTPUT_SWAP;
+				} else if (strcmp(optarg, "table") == 0) {
+					out_format = OUTPUT_TABLE;
+				} else if (strcmp(optarg, "dir") == 0) {
+					out_format = OUTPUT_DIR;
+				} else {
+					fprintf(stderr, "*** Unknown output format '%s'.\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'I':
+				invert = 1;
+				break;
+			case 'N':
+				operand_name = optarg;
+				break;
+			case 'e':
+				expr = optarg;
+				break;
+			case 'd':
+				diff_path = optarg;
+				break;
+			case 'b':
+				exit(parse_bench(optarg) < 0 ? 1 : 0);
+			case 'S':
+				exit(sort_bench(strtoul(optarg, NULL, 10)) < 0 ? 1 : 0);
+			case 'j':
+				nr_threads = atoi(optarg);
+				sort_threads = nr_threads > 0 ? nr_threads : 1;
+				break;
+			case 'm': {
+				char *endp;
+				memory = strtoul(optarg, &endp, 10);
+				if (*endp == 'K' || *endp == 'k')
+					memory <<= 10;
+				else if (*endp == 'G' || *endp == 'g')
+					memory <<= 30;
+				else
+					memory <<= 20;
+				if (endp == optarg || (*endp && endp[1]) || memory == 0) {
+					fprintf(stderr, "*** Invalid memory size '%s'.\n", optarg);
+					exit(1);
+				}
+				break;
+			}
+			case 's':
+				if (strcmp(optarg, "auto") == 0) {
+					sort_method = SORT_AUTO;
+				} else if (strcmp(optarg, "qsort") == 0) {
+					sort_method = SORT_QSORT;
+				} else if (strcmp(optarg, "radix") == 0) {
+					sort_method = SORT_RADIX;
+				} else {
+					fprintf(stderr, "*** Unknown sort method '%s'.\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'g':
+				gap = strtoul(optarg, NULL, 10);
+				if (gap > 0xffffffffUL)
+					gap = 0xffffffffUL;
+				break;
+			case 'T':
+				target = strtoul(optarg, NULL, 10);
+				break;
+			case 'H':
+				histogram = 1;
+				break;
+			case 'L':
+				max_lens = atoi(optarg);
+				if (max_lens < 0 || max_lens > 33) {
+					fprintf(stderr, "*** Invalid number of prefix lengths '%s'.\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'B':
+				budget = strtoul(optarg, NULL, 10);
+				break;
+			case OPT_STATS:
+				stats = 1;
+				stats_path = optarg;
+				break;
+			case 'h':
+				print_help(argc, argv);
+				exit(0);
+			default:
+				print_help(argc, argv);
+				exit(1);
+			}
+		}
+
+		/* Nothing given, read from stdin */
+		if (optind < argc)
+			path = argv[optind++];
+		else if (nr_files == 0)
+			path = "-";
+		else
+			break;
+
+		if (nr_sets == 0 && sets_init(countries, set_names) < 0)
+			exit(1);
+		if (!inet6 && max_bits > 32) {
+			fprintf(stderr, "*** Invalid prefix length '%d'.\n", max_bits);
+			exit(1);
+		}
+		if (inet6) {
+			if (operand_name || expr) {
+				fprintf(stderr, "*** '-N' and '-e' do not work with '-6'.\n");
+				exit(1);
+			}
+			if (sets6_load_file(path, in_format, max_bits < 0 ? 128 : max_bits) < 0)
+				exit(1);
+		} else {
+			/* Parsed later, all files at once */
+			struct sa_job *job = &jobs[nr_jobs];
+			if (nr_jobs >= MAX_JOBS) {
+				fprintf(stderr, "*** Too many files, at most %d.\n", MAX_JOBS);
+				exit(1);
+			}
+			if (operand_name) {
+				/* A named file, kept aside for the expression */
+				if (nr_operands >= MAX_OPERANDS) {
+					fprintf(stderr, "*** Too many named files, at most %d.\n", MAX_OPERANDS);
+					exit(1);
+				}
+				job->operand = &operands[nr_operands++];
+				job->operand->name = operand_name;
+				operand_name = NULL;
+			} else if (expr) {
+				fprintf(stderr, "*** '%s' needs a name ('-N') to be used with '-e'.\n", path);
+				exit(1);
+			}
+			job->path = path;
+			job->format = in_format;
+			job->max_bits = max_bits < 0 ? 32 : max_bits;
+			nr_jobs++;
+		}
+		nr_files++;
+	}
+
+	if (nr_threads < 1)
+		nr_threads = 1;
+	if (memory) {
+		/* Split among the parsing threads, half of each is for the sort */
+		int nr = nr_threads < nr_jobs ? nr_threads : (nr_jobs ? nr_jobs : 1);
+		run_size = memory / (2 * sizeof(struct ipv4_range) * nr);
+		if (run_size < RSORT_RADIX_MIN)
+			run_size = RSORT_RADIX_MIN;
+	}
+	if (nr_jobs && (sets_parse_all(nr_threads) < 0 || sets_collect() < 0))
+		exit(1);
+
+	if (expr) {
+		if (nr_files > nr_operands) {
+			fprintf(stderr, "*** All files need a name ('-N') to be used with '-e'.\n");
+			exit(1);
+		}
+		for (i = 0; i < nr_sets; i++) {
+			struct sa_open_data *od = salist_evaluate(expr, i);
+			if (!od)
+				exit(1);
+			salist_free(sets[i].od);
+			sets[i].od = od;
+		}
+	}
+
+	if ((out_format == OUTPUT_TABLE || out_format == OUTPUT_DIR) && nr_sets != 1) {
+		fprintf(stderr, "*** Binary tables take exactly one set.\n");
+		exit(1);
+	}
+	if (diff_path && (nr_sets != 1 ||
+		(out_format != OUTPUT_IPSET && out_format != OUTPUT_CIDR))) {
+		fprintf(stderr, "*** '-d' takes exactly one set and 'ipset' or 'cidr' output.\n");
+		exit(1);
+	}
+
+	if (max_lens >= 0 && (out_format == OUTPUT_RANGE || out_format == OUTPUT_TABLE ||
+		out_format == OUTPUT_DIR)) {
+		fprintf(stderr, "*** '-L' needs 'cidr', 'ipset' or 'swap' output.\n");
+		exit(1);
+	}
+
+	if (inet6) {
+		if (invert || diff_path || out_format == OUTPUT_TABLE || out_format == OUTPUT_DIR) {
+			fprintf(stderr, "*** '-I', '-d' and binary tables do not work with '-6'.\n");
+			exit(1);
+		}
+		if (max_lens >= 0 || gap || target || memory || stats) {
+			fprintf(stderr, "*** '-L', '-g', '-T', '-m' and '--stats' do not work with '-6'.\n");
+			exit(1);
+		}
+		for (i = 0; i < nr_sets; i++) {
+			salist6_close(sets[i].od6);
+			if (histogram) {
+				size_t hist[129];
+				salist6_prefix_histogram(sets[i].od6, hist);
+				print_prefix_histogram(sets[i].name, hist, 128);
+			}
+			if (nr_sets > 1 && out_format != OUTPUT_IPSET && out_format != OUTPUT_SWAP)
+				printf("# %s\n", sets[i].country);
+			if (out_format == OUTPUT_SWAP)
+				snprintf(new_name, sizeof(new_name), "%s-new", sets[i].name);
+			sa6_open_data_dump(sets[i].od6, out_format == OUTPUT_RANGE,
+				out_format == OUTPUT_CIDR ? NULL : sets[i].name,
+				out_format == OUTPUT_SWAP ? new_name : NULL);
+		}
+		return 0;
+	}
+
+	for (i = 0; i < nr_sets; i++) {
+		salist_close(sets[i].od);
+		sets[i].ranges_merged = sets[i].od->tmp_length;
+		if (invert && salist_invert(sets[i].od) < 0) {
+			fprintf(stderr, "*** Out of memory.\n");
+			exit(1);
+		}
+		if (gap || target) {
+			struct sa_open_data *od = sets[i].od;
+			size_t hist[33], nr_before = salist_prefix_histogram(od, hist);
+			uint64_t covered = 0;
+			int64_t added;
+			size_t n;
+
+			for (n = 0; n < od->tmp_length; n++)
+				covered += (uint64_t)od->tmp_base[n].end - od->tmp_base[n].start + 1;
+			added = salist_merge(od, gap);
+			if (target) {
+				int64_t more = salist_reduce(od, target);
+				if (more < 0) {
+					fprintf(stderr, "*** Out of memory.\n");
+					exit(1);
+				}
+				added += more;
+			}
+			n = salist_prefix_histogram(od, hist);
+			if (target && n > target) {
+				fprintf(stderr, "*** %s: %lu networks at the fewest, over the target.\n",
+					sets[i].name, (unsigned long)n);
+				exit(1);
+			}
+			fprintf(stderr, "%s: %lu networks approximated by %lu, %lld addresses added "
+				"to %llu (%.3f%%)\n", sets[i].name, (unsigned long)nr_before,
+				(unsigned long)n, (long long)added,
+				(unsigned long long)covered, covered ? 100.0 * added / covered : 0.0);
+		}
+		if (out_format == OUTPUT_TABLE || out_format == OUTPUT_DIR) {
+			struct rtable_dir rd;
+			int ret;
+
+			if (isatty(STDOUT_FILENO)) {
+				fprintf(stderr, "*** Not writing a binary table to a terminal.\n");
+				exit(1);
+			}
+			t = now_sec();
+			if (out_format == OUTPUT_TABLE) {
+				ret = rtable_write(stdout, sets[i].od->tmp_base, sets[i].od->tmp_length);
+			} else if ((ret = rtable_dir_build(&rd, sets[i].od->tmp_base,
+					sets[i].od->tmp_length)) == 0) {
+				ret = rtable_dir_write(stdout, &rd);
+				rtable_dir_close(&rd);
+			}
+			if (ret < 0) {
+				fprintf(stderr, "*** Failed to write the table: %s.\n", strerror(-ret));
+				exit(1);
+			}
+			phase_add(PHASE_EMIT, t);
+			continue;
+		}
+		if (max_lens >= 0) {
+			struct sa_open_data *od;
+			size_t hist[33], nr_before = salist_prefix_histogram(sets[i].od, hist);
+			int nr_lens;
+
+			if (!(od = salist_expand(sets[i].od, max_lens, budget, &nr_lens))) {
+				fprintf(stderr, "*** Out of memory.\n");
+				exit(1);
+			}
+			if (budget && od->tmp_length > budget)
+				fprintf(stderr, "*** %s: %lu networks with %d prefix lengths, over the budget.\n",
+					sets[i].name, (unsigned long)od->tmp_length, nr_lens);
+			else if (histogram)
+				fprintf(stderr, "%s: %lu networks expanded to %lu, %d prefix lengths\n",
+					sets[i].name, (unsigned long)nr_before,
+					(unsigned long)od->tmp_length, nr_lens);
+			salist_free(sets[i].od);
+			sets[i].od = od;
+		}
+		if (histogram) {
+			size_t hist[33];
+			salist_prefix_histogram(sets[i].od, hist);
+			print_prefix_histogram(sets[i].name, hist, 32);
+		}
+		t = now_sec();
+		if (diff_path) {
+			if (sa_open_data_dump_diff(sets[i].od, diff_path, out_format,
+					sets[i].name) < 0)
+				exit(1);
+			phase_add(PHASE_EMIT, t);
+			continue;
+		}
+		if (nr_sets > 1 && out_format != OUTPUT_IPSET && out_format != OUTPUT_SWAP)
+			printf("# %s\n", sets[i].country);
+		sa_open_data_dump(sets[i].od, out_format, sets[i].name);
+		fflush(stdout);
+		phase_add(PHASE_EMIT, t);
+	}
+
+	if (memory) {
+		struct rusage ru;
+		getrusage(RUSAGE_SELF, &ru);
+		fflush(stdout);
+		fprintf(stderr, "Peak RSS %ld KiB, %lu ranges spilled in %lu runs\n",
+			ru.ru_maxrss, (unsigned long)nr_spilled, (unsigned long)nr_spilled_runs);
+	}
+	if (stats) {
+		FILE *fp = stderr;
+		if (stats_path && strcmp(stats_path, "-") && !(fp = fopen(stats_path, "w"))) {
+			fprintf(stderr, "*** Cannot write '%s': %s.\n", stats_path, strerror(errno));
+			exit(1);
+		}
+		sets_print_stats(fp, t_start);
+		if (fp != stderr)
+			fclose(fp);
+	}
+
+	return 0;
+}
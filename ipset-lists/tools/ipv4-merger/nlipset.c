@@ -0,0 +1,383 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_hash.h>
+
+#include "nlipset.h"
+
+#ifndef NETLINK_CAP_ACK
+#define NETLINK_CAP_ACK 10
+#endif
+
+#define NLA_ALIGN4(len)  (((len) + 3) & ~3)
+
+/* An IPv6 entry with its CIDR: DATA { IP { IPADDR_IPV6 }, CIDR } */
+#define NLIPSET_ENTRY_MAX  (3 * NLA_HDRLEN + 16 + NLA_ALIGN4(NLA_HDRLEN + 1))
+
+/**
+ * A failed ADD with IPSET_ATTR_LINENO is answered by ipset itself, with
+ *  the whole request in the NLMSG_ERROR, whatever NETLINK_CAP_ACK says.
+ */
+#define NLIPSET_RECV_SIZE  (NLIPSET_MSG_SIZE + NLMSG_HDRLEN + sizeof(struct nlmsgerr))
+
+static void *nl_put(struct nlipset *s, size_t len)
+{
+	void *p = s->buf + s->len;
+
+	memset(p, 0, NLA_ALIGN4(len));
+	s->len += NLA_ALIGN4(len);
+	return p;
+}
+
+static size_t nla_put(struct nlipset *s, uint16_t type, const void *data, size_t len)
+{
+	size_t off = s->len;
+	struct nlattr *nla = nl_put(s, NLA_HDRLEN + len);
+
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	if (len)
+		memcpy((char *)nla + NLA_HDRLEN, data, len);
+	return off;
+}
+
+static inline void nla_put_str(struct nlipset *s, uint16_t type, const char *str)
+{
+	nla_put(s, type, str, strlen(str) + 1);
+}
+
+static inline void nla_put_u8(struct nlipset *s, uint16_t type, uint8_t u8)
+{
+	nla_put(s, type, &u8, sizeof(u8));
+}
+
+static inline void nla_put_be32(struct nlipset *s, uint16_t type, uint32_t u32)
+{
+	u32 = htonl(u32);
+	nla_put(s, type | NLA_F_NET_BYTEORDER, &u32, sizeof(u32));
+}
+
+static inline size_t nla_nest_start(struct nlipset *s, uint16_t type)
+{
+	return nla_put(s, type | NLA_F_NESTED, NULL, 0);
+}
+
+static inline void nla_nest_end(struct nlipset *s, size_t off)
+{
+	((struct nlattr *)(s->buf + off))->nla_len = s->len - off;
+}
+
+/* Append the header of an ipset request to the buffer */
+static void nlipset_msg_begin(struct nlipset *s, int cmd, uint16_t flags)
+{
+	struct nlmsghdr *nlh;
+	struct nfgenmsg *nfg;
+
+	s->msg = s->len;
+	nlh = nl_put(s, NLMSG_HDRLEN);
+	nlh->nlmsg_type = (NFNL_SUBSYS_IPSET << 8) | cmd;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	nlh->nlmsg_seq = ++s->seq;
+	nfg = nl_put(s, sizeof(*nfg));
+	nfg->nfgen_family = s->family;
+	nfg->version = NFNETLINK_V0;
+	nfg->res_id = htons(0);
+	nla_put_u8(s, IPSET_ATTR_PROTOCOL, IPSET_PROTOCOL_MIN);
+	s->nr_msgs++;
+}
+
+static inline void nlipset_msg_end(struct nlipset *s)
+{
+	((struct nlmsghdr *)(s->buf + s->msg))->nlmsg_len = s->len - s->msg;
+}
+
+/**
+ * Send the buffered messages and collect an acknowledgement for each,
+ *  return the first error. With 'revision', pick up the highest type
+ *  revision from an IPSET_CMD_TYPE reply.
+ */
+static int nlipset_transact(struct nlipset *s, uint8_t *revision)
+{
+	struct sockaddr_nl sa;
+	uint8_t rbuf[NLIPSET_RECV_SIZE];
+	uint32_t first_seq = s->seq - s->nr_msgs + 1;
+	unsigned nr_acks = 0;
+	ssize_t rc;
+	int ret = 0;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	rc = sendto(s->fd, s->buf, s->len, 0, (struct sockaddr *)&sa, sizeof(sa));
+	s->len = 0;
+	if (rc < 0) {
+		s->nr_msgs = 0;
+		return -errno;
+	}
+
+	while (nr_acks < s->nr_msgs) {
+		struct nlmsghdr *nlh;
+		size_t left;
+
+		if ((rc = recv(s->fd, rbuf, sizeof(rbuf), MSG_TRUNC)) < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			break;
+		}
+		if ((size_t)rc > sizeof(rbuf)) {
+			/* Cut off: its header still tells which request failed and why */
+			nlh = (struct nlmsghdr *)rbuf;
+			if (nlh->nlmsg_type == NLMSG_ERROR &&
+				nlh->nlmsg_seq >= first_seq && nlh->nlmsg_seq <= s->seq) {
+				int err = ((struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+				if (err < 0 && ret == 0)
+					ret = err;
+				nr_acks++;
+			}
+			continue;
+		}
+		for (nlh = (struct nlmsghdr *)rbuf, left = rc; NLMSG_OK(nlh, left);
+			 nlh = NLMSG_NEXT(nlh, left)) {
+			if (nlh->nlmsg_seq < first_seq || nlh->nlmsg_seq > s->seq)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				int err = ((struct nlmsgerr *)NLMSG_DATA(nlh))->error;
+				if (err < 0 && ret == 0)
+					ret = err;
+				nr_acks++;
+			} else if (revision && (nlh->nlmsg_type & 0xff) == IPSET_CMD_TYPE) {
+				struct nlattr *nla = (struct nlattr *)((char *)NLMSG_DATA(nlh) +
+						NLA_ALIGN4(sizeof(struct nfgenmsg)));
+				int alen = nlh->nlmsg_len - ((char *)nla - (char *)nlh);
+				while (alen >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN &&
+					nla->nla_len <= alen) {
+					if ((nla->nla_type & NLA_TYPE_MASK) == IPSET_ATTR_REVISION)
+						*revision = *((uint8_t *)nla + NLA_HDRLEN);
+					alen -= NLA_ALIGN4(nla->nla_len);
+					nla = (struct nlattr *)((char *)nla + NLA_ALIGN4(nla->nla_len));
+				}
+			}
+		}
+	}
+	s->nr_msgs = 0;
+	return ret;
+}
+
+int nlipset_open(struct nlipset *s, const char *set_name, int inet6)
+{
+	struct sockaddr_nl sa;
+	int on = 1, size = 1 << 20;
+
+	memset(s, 0, sizeof(*s));
+	if (strlen(set_name) >= sizeof(s->name))
+		return -ENAMETOOLONG;
+	strcpy(s->name, set_name);
+	s->family = inet6 ? NFPROTO_IPV6 : NFPROTO_IPV4;
+
+	if ((s->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER)) < 0)
+		return -errno;
+	/* Acknowledgements of errors without the whole request in them */
+	setsockopt(s->fd, SOL_NETLINK, NETLINK_CAP_ACK, &on, sizeof(on));
+	setsockopt(s->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	if (bind(s->fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		int ret = -errno;
+		close(s->fd);
+		s->fd = -1;
+		return ret;
+	}
+	return 0;
+}
+
+void nlipset_close(struct nlipset *s)
+{
+	if (s->fd >= 0)
+		close(s->fd);
+	s->fd = -1;
+}
+
+/* Open an IPSET_ATTR_DATA entry, in a new message or buffer if needed */
+static int nlipset_entry_begin(struct nlipset *s, size_t *data)
+{
+	int ret;
+
+	if (s->nr_msgs && s->len - s->msg + NLIPSET_ENTRY_MAX > NLIPSET_MSG_SIZE) {
+		nla_nest_end(s, s->adt);
+		nlipset_msg_end(s);
+		if (s->len + NLIPSET_MSG_SIZE > sizeof(s->buf) &&
+			(ret = nlipset_flush(s)) < 0)
+			return ret;
+		s->adt = 0;
+	}
+	if (!s->adt) {
+		/* No NLM_F_EXCL: existing entries are fine */
+		nlipset_msg_begin(s, IPSET_CMD_ADD, 0);
+		nla_put_str(s, IPSET_ATTR_SETNAME, s->name);
+		/* Required with IPSET_ATTR_ADT, where errors are reported by line */
+		nla_put(s, IPSET_ATTR_LINENO, &(uint32_t){ 0 }, sizeof(uint32_t));
+		s->adt = nla_nest_start(s, IPSET_ATTR_ADT);
+	}
+	*data = nla_nest_start(s, IPSET_ATTR_DATA);
+	return 0;
+}
+
+int nlipset_add(struct nlipset *s, uint32_t ip, int cidr)
+{
+	size_t data, nest;
+	int ret;
+
+	if ((ret = nlipset_entry_begin(s, &data)) < 0)
+		return ret;
+	nest = nla_nest_start(s, IPSET_ATTR_IP);
+	nla_put_be32(s, IPSET_ATTR_IPADDR_IPV4, ip);
+	nla_nest_end(s, nest);
+	if (cidr < 32)
+		nla_put_u8(s, IPSET_ATTR_CIDR, cidr);
+	nla_nest_end(s, data);
+	s->nr_queued++;
+	return 0;
+}
+
+int nlipset_add6(struct nlipset *s, const uint8_t ip[16], int cidr)
+{
+	size_t data, nest;
+	int ret;
+
+	if ((ret = nlipset_entry_begin(s, &data)) < 0)
+		return ret;
+	nest = nla_nest_start(s, IPSET_ATTR_IP);
+	nla_put(s, IPSET_ATTR_IPADDR_IPV6 | NLA_F_NET_BYTEORDER, ip, 16);
+	nla_nest_end(s, nest);
+	if (cidr < 128)
+		nla_put_u8(s, IPSET_ATTR_CIDR, cidr);
+	nla_nest_end(s, data);
+	s->nr_queued++;
+	return 0;
+}
+
+int nlipset_flush(struct nlipset *s)
+{
+	int ret;
+
+	if (s->nr_msgs == 0)
+		return 0;
+	if (s->adt) {
+		nla_nest_end(s, s->adt);
+		nlipset_msg_end(s);
+		s->adt = 0;
+	}
+	if ((ret = nlipset_transact(s, NULL)) == 0)
+		s->nr_sent += s->nr_queued;
+	s->nr_queued = 0;
+	return ret;
+}
+
+int nlipset_create(struct nlipset *s, const char *name, const char *type,
+		uint32_t hashsize, uint32_t maxelem)
+{
+	uint8_t revision = 0;
+	size_t data;
+	int ret;
+
+	if ((ret = nlipset_flush(s)) < 0)
+		return ret;
+
+	/* The newest revision of the type both sides know */
+	nlipset_msg_begin(s, IPSET_CMD_TYPE, 0);
+	nla_put_str(s, IPSET_ATTR_TYPENAME, type);
+	nla_put_u8(s, IPSET_ATTR_FAMILY, s->family);
+	nlipset_msg_end(s);
+	if ((ret = nlipset_transact(s, &revision)) < 0)
+		return ret;
+
+	nlipset_msg_begin(s, IPSET_CMD_CREATE, NLM_F_CREATE | NLM_F_EXCL);
+	nla_put_str(s, IPSET_ATTR_SETNAME, name);
+	nla_put_str(s, IPSET_ATTR_TYPENAME, type);
+	nla_put_u8(s, IPSET_ATTR_REVISION, revision);
+	nla_put_u8(s, IPSET_ATTR_FAMILY, s->family);
+	data = nla_nest_start(s, IPSET_ATTR_DATA);
+	if (hashsize)
+		nla_put_be32(s, IPSET_ATTR_HASHSIZE, hashsize);
+	if (maxelem)
+		nla_put_be32(s, IPSET_ATTR_MAXELEM, maxelem);
+	nla_nest_end(s, data);
+	nlipset_msg_end(s);
+	return nlipset_transact(s, NULL);
+}
+
+int nlipset_destroy(struct nlipset *s, const char *name)
+{
+	int ret;
+
+	if ((ret = nlipset_flush(s)) < 0)
+		return ret;
+	nlipset_msg_begin(s, IPSET_CMD_DESTROY, 0);
+	nla_put_str(s, IPSET_ATTR_SETNAME, name);
+	nlipset_msg_end(s);
+	return nlipset_transact(s, NULL);
+}
+
+int nlipset_swap(struct nlipset *s, const char *name1, const char *name2)
+{
+	int ret;
+
+	if ((ret = nlipset_flush(s)) < 0)
+		return ret;
+	nlipset_msg_begin(s, IPSET_CMD_SWAP, 0);
+	nla_put_str(s, IPSET_ATTR_SETNAME, name1);
+	nla_put_str(s, IPSET_ATTR_SETNAME2, name2);
+	nlipset_msg_end(s);
+	return nlipset_transact(s, NULL);
+}
+
+/* Return 1 if the set exists, 0 if not, or an error */
+int nlipset_exists(struct nlipset *s, const char *name)
+{
+	int ret;
+
+	if ((ret = nlipset_flush(s)) < 0)
+		return ret;
+	nlipset_msg_begin(s, IPSET_CMD_HEADER, 0);
+	nla_put_str(s, IPSET_ATTR_SETNAME, name);
+	nlipset_msg_end(s);
+	ret = nlipset_transact(s, NULL);
+	return ret == 0 ? 1 : (ret == -ENOENT ? 0 : ret);
+}
+
+const char *nlipset_strerror(int err)
+{
+	switch (-err) {
+	case IPSET_ERR_PROTOCOL:
+		return "kernel ipset protocol error";
+	case ENOENT:
+		return "set does not exist";
+	case IPSET_ERR_FIND_TYPE:
+		return "set type is not supported by the kernel";
+	case IPSET_ERR_EXIST_SETNAME2:
+		return "second set does not exist";
+	case IPSET_ERR_TYPE_MISMATCH:
+		return "sets are of different types";
+	case IPSET_ERR_EXIST:
+		return "set or entry already exists";
+	case IPSET_ERR_REFERENCED:
+		return "set is in use";
+	case IPSET_ERR_HASH_FULL:
+		return "set is full";
+	case IPSET_ERR_INVALID_CIDR:
+		return "invalid prefix length for the set";
+	case IPSET_ERR_INVALID_FAMILY:
+		return "set is of another family";
+	default:
+		return strerror(-err);
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef __NLIPSET_H
+#define __NLIPSET_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Minimal netlink client for the kernel IP sets, no libipset/libmnl.
+ *  Entries are queued into IPSET_CMD_ADD messages in the 'multiple data
+ *  containers' (IPSET_ATTR_ADT) form 'ipset restore' uses, and several
+ *  such messages go to the kernel in a single send.
+ */
+#define NLIPSET_BUF_SIZE  65536   /* one send */
+#define NLIPSET_MSG_SIZE  8192    /* one message */
+
+struct nlipset {
+	int      fd;
+	uint32_t seq;
+	char     name[32];        /* IPSET_MAXNAMELEN, the set added to */
+	uint8_t  family;          /* NFPROTO_IPV4 or NFPROTO_IPV6 */
+	uint8_t  buf[NLIPSET_BUF_SIZE];
+	size_t   len;
+	size_t   msg;             /* offset of the message being built */
+	size_t   adt;             /* offset of its IPSET_ATTR_ADT attribute */
+	unsigned nr_msgs;         /* messages in 'buf' */
+	size_t   nr_queued;
+	size_t   nr_sent;
+};
+
+/* 'inet6' selects the IPv6 family for the set to add to */
+int nlipset_open(struct nlipset *s, const char *set_name, int inet6);
+void nlipset_close(struct nlipset *s);
+
+/* Queue 'ip'/'cidr' for adding, sending if the buffer is full */
+int nlipset_add(struct nlipset *s, uint32_t ip, int cidr);       /* host byte order */
+int nlipset_add6(struct nlipset *s, const uint8_t ip[16], int cidr);
+
+/* Send the queued entries and wait for the kernel to take them */
+int nlipset_flush(struct nlipset *s);
+
+/**
+ * Set management, one request each, in the family of 's'. A 'hashsize'
+ *  or 'maxelem' of 0 leaves the kernel default.
+ */
+int nlipset_create(struct nlipset *s, const char *name, const char *type,
+		uint32_t hashsize, uint32_t maxelem);
+int nlipset_destroy(struct nlipset *s, const char *name);
+int nlipset_swap(struct nlipset *s, const char *name1, const char *name2);
+int nlipset_exists(struct nlipset *s, const char *name);
+
+/* Return a message for the errors of nlipset_*() */
+const char *nlipset_strerror(int err);
+
+#endif /* __NLIPSET_H */
@@ -0,0 +1,401 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "rtable.h"
+
+/**
+ * Helper of 'bench.sh':
+ *  gen - write a synthetic list of networks and ranges, shaped after a
+ *        real one (the seed list) and reproducible for a given seed
+ *  run - run a command and print its wall time and peak memory
+ */
+
+static char *ipv4_hltos(uint32_t u, char *s)
+{
+	sprintf(s, "%u.%u.%u.%u", u >> 24, (u >> 16) & 0xff, (u >> 8) & 0xff, u & 0xff);
+	return s;
+}
+
+/* xorshift64*, the same list for the same seed everywhere */
+static uint64_t rng_state = 1;
+
+static inline uint32_t rng_next(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (uint32_t)((rng_state * 2685821657736338717ULL) >> 32);
+}
+
+/* Uniform in [0, n), n > 0 */
+static inline uint32_t rng_below(uint64_t n)
+{
+	return (uint32_t)(((uint64_t)rng_next() * n) >> 32);
+}
+
+static inline uint32_t net_last(uint32_t net, int bits)
+{
+	return net | (uint32_t)((1ULL << (32 - bits)) - 1);
+}
+
+/* The networks of the seed list, and how often each prefix length is seen */
+struct seed_list {
+	struct ipv4_range *nets;
+	int *bits;
+	size_t nr;
+	size_t hist[33];
+};
+
+static int seed_list_load(struct seed_list *sl, const char *path)
+{
+	char lbuf[128];
+	size_t size = 0;
+	FILE *fp;
+
+	memset(sl, 0, sizeof(*sl));
+	if (!(fp = fopen(path, "r"))) {
+		fprintf(stderr, "*** Cannot open '%s': %s.\n", path, strerror(errno));
+		return -errno;
+	}
+	while (fgets(lbuf, sizeof(lbuf), fp)) {
+		char *sep = strchr(lbuf, '/');
+		uint32_t net;
+		int bits = 32;
+
+		lbuf[strcspn(lbuf, "\r\n")] = '\0';
+		if (sep)
+			bits = atoi(sep + 1);
+		if (ipv4_parse_n(lbuf, sep ? (size_t)(sep - lbuf) : strlen(lbuf), &net) < 0 ||
+			bits < 1 || bits > 32)
+			continue;
+		if (sl->nr >= size) {
+			size = size ? size * 2 : 1024;
+			sl->nets = realloc(sl->nets, sizeof(struct ipv4_range) * size);
+			sl->bits = realloc(sl->bits, sizeof(int) * size);
+			if (!sl->nets || !sl->bits) {
+				fclose(fp);
+				return -ENOMEM;
+			}
+		}
+		net &= ~(uint32_t)((1ULL << (32 - bits)) - 1);
+		sl->nets[sl->nr].start = net;
+		sl->nets[sl->nr].end = net_last(net, bits);
+		sl->bits[sl->nr++] = bits;
+		sl->hist[bits]++;
+	}
+	fclose(fp);
+	if (sl->nr == 0) {
+		fprintf(stderr, "*** No networks in '%s'.\n", path);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* A prefix length as often as in the seed list */
+static int seed_list_bits(const struct seed_list *sl)
+{
+	size_t k = rng_below(sl->nr);
+	int bits;
+
+	for (bits = 1; bits < 32 && k >= sl->hist[bits]; bits++)
+		k -= sl->hist[bits];
+	return bits;
+}
+
+/* A random network of 'bits' inside the seed network 'i' (or itself) */
+static struct ipv4_range seed_subnet(const struct seed_list *sl, size_t i, int bits)
+{
+	struct ipv4_range r;
+	int extra;
+
+	if (bits < sl->bits[i])
+		bits = sl->bits[i];
+	if (bits > 32)
+		bits = 32;
+	extra = bits - sl->bits[i];
+	r.start = sl->nets[i].start;
+	if (extra)
+		r.start += rng_below(1ULL << extra) << (32 - bits);
+	r.end = net_last(r.start, bits);
+	return r;
+}
+
+/* An unaligned range inside 'net' */
+static struct ipv4_range inner_range(struct ipv4_range net)
+{
+	uint64_t size = (uint64_t)net.end - net.start + 1;
+	struct ipv4_range r;
+
+	r.start = net.start + rng_below(size);
+	r.end = r.start + rng_below((uint64_t)net.end - r.start + 1);
+	return r;
+}
+
+enum gen_kind {
+	GEN_RANDOM,     /* anywhere, prefix lengths as in the seed list */
+	GEN_REAL,       /* the seed networks, their subnets and neighbours */
+	GEN_OVERLAP,    /* nested networks of all lengths in a few hot spots */
+	GEN_ADJACENT,   /* blocks that touch each other, merging into long runs */
+	GEN_DENSE,      /* many single addresses in a few /16s */
+};
+
+static int gen_list(const struct seed_list *sl, enum gen_kind kind, size_t nr,
+		int ranges, struct ipv4_range *out)
+{
+	size_t i, nr_spots = nr / 1000 + 16, nr_16s = nr / 32768 + 1;
+	uint32_t cursor = 0;
+
+	/* Hot spots and /16s are seeds spread evenly over the list */
+	if (nr_spots > sl->nr)
+		nr_spots = sl->nr;
+	if (nr_16s > sl->nr)
+		nr_16s = sl->nr;
+
+	for (i = 0; i < nr; i++) {
+		struct ipv4_range *r = &out[i];
+		size_t s = rng_below(sl->nr);
+		int bits;
+
+		switch (kind) {
+		case GEN_RANDOM:
+			bits = seed_list_bits(sl);
+			r->start = (0x01000000 + rng_below(0xdf000000)) &
+				~(uint32_t)((1ULL << (32 - bits)) - 1);
+			r->end = net_last(r->start, bits);
+			if (ranges && rng_below(8) == 0)
+				*r = inner_range(*r);
+			break;
+		case GEN_REAL:
+			switch (rng_below(8)) {
+			case 0:
+			case 1:
+				*r = sl->nets[s];
+				break;
+			case 6:
+				/* The next block of the same size, often allocated later */
+				bits = sl->bits[s];
+				if (sl->nets[s].end != 0xffffffff) {
+					r->start = sl->nets[s].end + 1;
+					r->end = net_last(r->start, bits);
+					break;
+				}
+				/* fall through */
+			case 7:
+				if (ranges) {
+					*r = inner_range(sl->nets[s]);
+					break;
+				}
+				/* fall through */
+			default:
+				*r = seed_subnet(sl, s, sl->bits[s] + 1 + rng_below(8));
+				break;
+			}
+			break;
+		case GEN_OVERLAP:
+			s = (size_t)rng_below(nr_spots) * (sl->nr / nr_spots);
+			*r = seed_subnet(sl, s, sl->bits[s] + rng_below(17));
+			if (ranges && rng_below(4) == 0)
+				*r = inner_range(*r);
+			break;
+		case GEN_ADJACENT: {
+			int host_bits;
+			if (cursor == 0 || rng_below(64) == 0)
+				cursor = sl->nets[s].start;
+			host_bits = cursor ? __builtin_ctz(cursor) : 32;
+			if (host_bits > 12)
+				host_bits = 12;
+			host_bits = rng_below(host_bits + 1);
+			r->start = cursor;
+			r->end = net_last(cursor, 32 - host_bits);
+			cursor = r->end + 1;
+			break;
+		}
+		case GEN_DENSE:
+			s = (size_t)rng_below(nr_16s) * (sl->nr / nr_16s);
+			r->start = r->end = (sl->nets[s].start & 0xffff0000) + rng_below(65536);
+			break;
+		}
+	}
+
+	/* Real lists come in no particular order */
+	for (i = nr; i > 1; i--) {
+		size_t j = rng_below(i);
+		struct ipv4_range tmp = out[i - 1];
+		out[i - 1] = out[j];
+		out[j] = tmp;
+	}
+	return 0;
+}
+
+static void print_range(const struct ipv4_range *r)
+{
+	uint32_t size = r->end - r->start;
+	char s1[20], s2[20];
+
+	if (r->start == r->end)
+		printf("%s\n", ipv4_hltos(r->start, s1));
+	else if ((size & (size + 1)) == 0 && (r->start & size) == 0)
+		printf("%s/%d\n", ipv4_hltos(r->start, s1), 32 - __builtin_popcount(size));
+	else
+		printf("%s-%s\n", ipv4_hltos(r->start, s1), ipv4_hltos(r->end, s2));
+}
+
+static int do_gen(int argc, char *argv[])
+{
+	const char *kinds[] = { "random", "real", "overlap", "adjacent", "dense", NULL };
+	enum gen_kind kind = GEN_RANDOM;
+	struct seed_list sl;
+	struct ipv4_range *out;
+	size_t nr = 1000, i;
+	int ranges = 0, opt, k;
+
+	while ((opt = getopt(argc, argv, "k:n:s:r")) != -1) {
+		switch (opt) {
+		case 'k':
+			for (k = 0; kinds[k] && strcmp(kinds[k], optarg); k++)
+				;
+			if (!kinds[k]) {
+				fprintf(stderr, "*** Unknown kind of list '%s'.\n", optarg);
+				return 1;
+			}
+			kind = (enum gen_kind)k;
+			break;
+		case 'n':
+			nr = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			rng_state = strtoull(optarg, NULL, 10) * 0x9e3779b97f4a7c15ULL + 1;
+			break;
+		case 'r':
+			ranges = 1;
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "*** No seed list given.\n");
+		return 1;
+	}
+	if (seed_list_load(&sl, argv[optind]) < 0)
+		return 1;
+	if (nr == 0 || !(out = malloc(sizeof(struct ipv4_range) * nr))) {
+		fprintf(stderr, "*** Cannot allocate %lu entries.\n", (unsigned long)nr);
+		return 1;
+	}
+
+	gen_list(&sl, kind, nr, ranges, out);
+	for (i = 0; i < nr; i++)
+		print_range(&out[i]);
+
+	free(out);
+	free(sl.nets);
+	free(sl.bits);
+	return fflush(stdout) == 0 ? 0 : 1;
+}
+
+static int redirect(const char *path, int fd, int flags)
+{
+	int nfd;
+
+	if (!path)
+		return 0;
+	if ((nfd = open(path, flags, 0644)) < 0) {
+		fprintf(stderr, "*** Cannot open '%s': %s.\n", path, strerror(errno));
+		return -1;
+	}
+	dup2(nfd, fd);
+	close(nfd);
+	return 0;
+}
+
+static int do_run(int argc, char *argv[])
+{
+	const char *in_path = NULL, *out_path = "/dev/null";
+	struct timespec t0, t1;
+	struct rusage ru;
+	pid_t pid;
+	int opt, status;
+
+	/* Options up to the command */
+	while ((opt = getopt(argc, argv, "+i:o:")) != -1) {
+		switch (opt) {
+		case 'i':
+			in_path = optarg;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			return 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "*** No command given.\n");
+		return 1;
+	}
+
+	fflush(stdout);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if ((pid = fork()) < 0) {
+		fprintf(stderr, "*** fork(): %s.\n", strerror(errno));
+		return 1;
+	}
+	if (pid == 0) {
+		if (redirect(in_path, STDIN_FILENO, O_RDONLY) < 0 ||
+			redirect(out_path, STDOUT_FILENO, O_WRONLY | O_CREAT | O_TRUNC) < 0)
+			_exit(127);
+		execvp(argv[optind], &argv[optind]);
+		fprintf(stderr, "*** Cannot run '%s': %s.\n", argv[optind], strerror(errno));
+		_exit(127);
+	}
+	if (wait4(pid, &status, 0, &ru) < 0) {
+		fprintf(stderr, "*** wait4(): %s.\n", strerror(errno));
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	/* Milliseconds and KiB */
+	printf("%.1f %ld\n", (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6,
+		ru.ru_maxrss);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static void print_help(int argc, char *argv[])
+{
+	printf("Synthetic route lists and measurements for 'bench.sh'.\n");
+	printf("Usage:\n");
+	printf("  %s gen [-k kind] [-n count] [-s seed] [-r] <seed_list>\n", argv[0]);
+	printf("  %s run [-i input] [-o output] <command> [args ...]\n", argv[0]);
+	printf("gen: write <count> (default: 1000) entries shaped after <seed_list>:\n");
+	printf("  -k random    anywhere, with the prefix lengths of the seed list (default)\n");
+	printf("  -k real      the seed networks, their subnets and next blocks\n");
+	printf("  -k overlap   nested networks of all lengths in a few hot spots\n");
+	printf("  -k adjacent  touching blocks that merge into long runs\n");
+	printf("  -k dense     many single addresses in a few /16s\n");
+	printf("  -s <seed>    the same seed gives the same list (default: 0)\n");
+	printf("  -r           also write unaligned ranges 'a.b.c.d-e.f.g.h'\n");
+	printf("run: print the wall time (ms) and the peak RSS (KiB) of the command,\n");
+	printf("  whose output goes to <output> (default: /dev/null), and exit with its status\n");
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc >= 2 && strcmp(argv[1], "gen") == 0)
+		return do_gen(argc - 1, argv + 1);
+	if (argc >= 2 && strcmp(argv[1], "run") == 0)
+		return do_run(argc - 1, argv + 1);
+	print_help(argc, argv);
+	return argc >= 2 && strcmp(argv[1], "-h") == 0 ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "rsort.h"
+
+#define RSORT_BITS     11
+#define RSORT_BUCKETS  (1 << RSORT_BITS)
+#define RSORT_PASSES   6
+
+static inline uint64_t range_key(const struct ipv4_range *r)
+{
+	return (uint64_t)r->start << 32 | r->end;
+}
+
+static int range_cmp(const void *a, const void *b)
+{
+	uint64_t ka = range_key(a), kb = range_key(b);
+	return ka < kb ? -1 : ka > kb;
+}
+
+int ipv4_range_qsort(struct ipv4_range *r, size_t n)
+{
+	qsort(r, n, sizeof(*r), range_cmp);
+	return 0;
+}
+
+/**
+ * Sort 'src' with 'dst' as the other buffer, return the one that holds
+ *  the result. 'count' is scratch for RSORT_PASSES * RSORT_BUCKETS.
+ */
+static struct ipv4_range *radix_sort(struct ipv4_range *src, struct ipv4_range *dst,
+		size_t n, size_t *count)
+{
+	size_t i;
+	int p;
+
+	memset(count, 0, sizeof(size_t) * RSORT_PASSES * RSORT_BUCKETS);
+	for (i = 0; i < n; i++) {
+		uint64_t k = range_key(&src[i]);
+		for (p = 0; p < RSORT_PASSES; p++)
+			count[p * RSORT_BUCKETS + ((k >> (p * RSORT_BITS)) & (RSORT_BUCKETS - 1))]++;
+	}
+
+	for (p = 0; p < RSORT_PASSES && n; p++) {
+		size_t *c = count + p * RSORT_BUCKETS, sum = 0, t;
+		int shift = p * RSORT_BITS, d;
+		struct ipv4_range *swap;
+
+		/* Every key has the same digit: nothing to do */
+		if (c[(range_key(&src[0]) >> shift) & (RSORT_BUCKETS - 1)] == n)
+			continue;
+		for (d = 0; d < RSORT_BUCKETS; d++) {
+			t = c[d];
+			c[d] = sum;
+			sum += t;
+		}
+		for (i = 0; i < n; i++)
+			dst[c[(range_key(&src[i]) >> shift) & (RSORT_BUCKETS - 1)]++] = src[i];
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+	return src;
+}
+
+int ipv4_range_radix_sort(struct ipv4_range *r, size_t n)
+{
+	struct ipv4_range *tmp, *res;
+	size_t *count;
+
+	if (n < 2)
+		return 0;
+	tmp = malloc(sizeof(*tmp) * n);
+	count = malloc(sizeof(size_t) * RSORT_PASSES * RSORT_BUCKETS);
+	if (!tmp || !count) {
+		free(tmp);
+		free(count);
+		return -ENOMEM;
+	}
+	if ((res = radix_sort(r, tmp, n, count)) != r)
+		memcpy(r, res, sizeof(*r) * n);
+	free(tmp);
+	free(count);
+	return 0;
+}
+
+/* Shared state of the partitioned sort */
+struct rsort_mt {
+	struct ipv4_range *r;
+	struct ipv4_range *tmp;
+	size_t n;
+	int nr_threads;
+	size_t (*hist)[256];      /* per thread, then its offsets */
+	size_t *counts;           /* radix_sort() scratch, per thread */
+	size_t bucket[257];       /* bucket starts in 'tmp' */
+	int next_bucket;
+	pthread_barrier_t barrier;
+	/* Workers wait here until all of them are known */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int started;
+};
+
+struct rsort_worker {
+	struct rsort_mt *mt;
+	int id;
+	pthread_t thread;
+};
+
+static void *rsort_mt_worker(void *arg)
+{
+	struct rsort_worker *w = arg;
+	struct rsort_mt *mt = w->mt;
+	size_t lo, hi, *hist = mt->hist[w->id], *count, i;
+	int b;
+
+	pthread_mutex_lock(&mt->lock);
+	while (!mt->started)
+		pthread_cond_wait(&mt->cond, &mt->lock);
+	pthread_mutex_unlock(&mt->lock);
+	lo = mt->n * w->id / mt->nr_threads;
+	hi = mt->n * (w->id + 1) / mt->nr_threads;
+	count = mt->counts + (size_t)w->id * RSORT_PASSES * RSORT_BUCKETS;
+
+	/* 1. Count the top bytes of this thread's share */
+	for (i = lo; i < hi; i++)
+		hist[mt->r[i].start >> 24]++;
+	pthread_barrier_wait(&mt->barrier);
+
+	/* 2. Offsets are set up by thread 0, then every share is scattered */
+	if (w->id == 0) {
+		size_t sum = 0;
+		int t;
+		for (b = 0; b < 256; b++) {
+			mt->bucket[b] = sum;
+			for (t = 0; t < mt->nr_threads; t++) {
+				size_t c = mt->hist[t][b];
+				mt->hist[t][b] = sum;
+				sum += c;
+			}
+		}
+		mt->bucket[256] = sum;
+	}
+	pthread_barrier_wait(&mt->barrier);
+	for (i = lo; i < hi; i++)
+		mt->tmp[hist[mt->r[i].start >> 24]++] = mt->r[i];
+	pthread_barrier_wait(&mt->barrier);
+
+	/* 3. Sort the buckets back into place */
+	while ((b = __sync_fetch_and_add(&mt->next_bucket, 1)) < 256) {
+		size_t start = mt->bucket[b], len = mt->bucket[b + 1] - start;
+		struct ipv4_range *res;
+		if (len == 0)
+			continue;
+		res = radix_sort(mt->tmp + start, mt->r + start, len, count);
+		if (res != mt->r + start)
+			memcpy(mt->r + start, res, sizeof(*res) * len);
+	}
+	return NULL;
+}
+
+int ipv4_range_radix_sort_mt(struct ipv4_range *r, size_t n, int nr_threads)
+{
+	struct rsort_worker *workers;
+	struct rsort_mt mt;
+	int i, ret = 0;
+
+	if (nr_threads < 2 || n < 2)
+		return ipv4_range_radix_sort(r, n);
+	memset(&mt, 0, sizeof(mt));
+	mt.r = r;
+	mt.n = n;
+	mt.tmp = malloc(sizeof(*r) * n);
+	mt.hist = calloc(nr_threads, sizeof(*mt.hist));
+	mt.counts = malloc(sizeof(size_t) * RSORT_PASSES * RSORT_BUCKETS * nr_threads);
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!mt.tmp || !mt.hist || !mt.counts || !workers) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	pthread_mutex_init(&mt.lock, NULL);
+	pthread_cond_init(&mt.cond, NULL);
+
+	/* The calling thread is worker 0, the others are as many as start */
+	for (i = 1; i < nr_threads; i++) {
+		workers[i].mt = &mt;
+		workers[i].id = i;
+		if (pthread_create(&workers[i].thread, NULL, rsort_mt_worker, &workers[i]) != 0)
+			break;
+	}
+	workers[0].mt = &mt;
+	mt.nr_threads = i;
+	pthread_barrier_init(&mt.barrier, NULL, mt.nr_threads);
+	pthread_mutex_lock(&mt.lock);
+	mt.started = 1;
+	pthread_cond_broadcast(&mt.cond);
+	pthread_mutex_unlock(&mt.lock);
+
+	rsort_mt_worker(&workers[0]);
+	for (i = 1; i < mt.nr_threads; i++)
+		pthread_join(workers[i].thread, NULL);
+	pthread_barrier_destroy(&mt.barrier);
+	pthread_cond_destroy(&mt.cond);
+	pthread_mutex_destroy(&mt.lock);
+
+out:
+	free(mt.tmp);
+	free(mt.hist);
+	free(mt.counts);
+	free(workers);
+	return ret;
+}
+
+int ipv4_range_sort(struct ipv4_range *r, size_t n, int nr_threads)
+{
+	int ret = -ENOMEM;
+
+	if (n >= RSORT_MT_MIN && nr_threads > 1)
+		ret = ipv4_range_radix_sort_mt(r, n, nr_threads);
+	else if (n >= RSORT_RADIX_MIN)
+		ret = ipv4_range_radix_sort(r, n);
+	if (ret < 0)
+		ipv4_range_qsort(r, n);
+	return 0;
+}
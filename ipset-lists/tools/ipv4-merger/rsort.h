@@ -0,0 +1,25 @@
+#ifndef __RSORT_H
+#define __RSORT_H
+
+#include <stddef.h>
+#include "rtable.h"
+
+/**
+ * Sorting of range arrays by (start, end), as one 64-bit key.
+ *  LSD radix sort takes 11 bits a pass, 6 passes at most, and skips the
+ *  passes whose digit is the same in all keys (often the low bits of
+ *  'end'). The partitioned variant first scatters the ranges by the top
+ *  byte of 'start' on all threads, then radix-sorts the 256 buckets on
+ *  them.
+ */
+#define RSORT_RADIX_MIN   1024      /* qsort() below this */
+#define RSORT_MT_MIN      (1 << 20) /* one thread below this */
+
+int ipv4_range_qsort(struct ipv4_range *r, size_t n);
+int ipv4_range_radix_sort(struct ipv4_range *r, size_t n);
+int ipv4_range_radix_sort_mt(struct ipv4_range *r, size_t n, int nr_threads);
+
+/* Pick the sort by 'n'; falls back to qsort() when out of memory */
+int ipv4_range_sort(struct ipv4_range *r, size_t n, int nr_threads);
+
+#endif /* __RSORT_H */
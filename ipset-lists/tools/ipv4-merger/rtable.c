@@ -0,0 +1,369 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "rtable.h"
+
+uint32_t rtable_crc32(uint32_t crc, const void *buf, size_t len)
+{
+	static uint32_t table[256];
+	const uint8_t *p = buf;
+	size_t i;
+
+	if (!table[1]) {
+		uint32_t c;
+		int j, k;
+		for (j = 0; j < 256; j++) {
+			for (c = j, k = 0; k < 8; k++)
+				c = (c & 1) ? (0xedb88320 ^ (c >> 1)) : (c >> 1);
+			table[j] = c;
+		}
+	}
+
+	crc = ~crc;
+	for (i = 0; i < len; i++)
+		crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+int rtable_write(FILE *fp, const struct ipv4_range *ranges, size_t count)
+{
+	struct rtable_header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = RTABLE_MAGIC;
+	hdr.version = RTABLE_VERSION;
+	hdr.family = RTABLE_FAMILY_INET;
+	hdr.header_size = sizeof(hdr);
+	hdr.count = count;
+	hdr.checksum = rtable_crc32(0, ranges, sizeof(struct ipv4_range) * count);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+		(count && fwrite(ranges, sizeof(struct ipv4_range), count, fp) != count) ||
+		fflush(fp) != 0)
+		return -EIO;
+	return 0;
+}
+
+/* Map a whole file read-only, at least 'min_len' bytes of it */
+static int rtable_map(const char *path, size_t min_len, void **base, size_t *len)
+{
+	struct stat st;
+	int fd, ret = 0;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0) {
+		ret = -errno;
+	} else if (st.st_size < min_len) {
+		fprintf(stderr, "[%s] '%s' is too short for a table.\n", __FUNCTION__, path);
+		ret = -EINVAL;
+	} else {
+		*len = st.st_size;
+		*base = mmap(NULL, *len, PROT_READ, MAP_SHARED, fd, 0);
+		if (*base == MAP_FAILED) {
+			*base = NULL;
+			ret = -errno;
+		}
+	}
+	close(fd);
+	return ret;
+}
+
+int rtable_open(struct rtable *rt, const char *path)
+{
+	const struct rtable_header *hdr;
+	int ret;
+
+	memset(rt, 0, sizeof(*rt));
+
+	if ((ret = rtable_map(path, sizeof(*hdr), &rt->map_base, &rt->map_len)) < 0)
+		return ret;
+
+	hdr = rt->map_base;
+	if (hdr->magic != RTABLE_MAGIC) {
+		fprintf(stderr, "[%s] '%s' is not a range table, or of other byte order.\n",
+				__FUNCTION__, path);
+		goto fail;
+	}
+	if (hdr->version != RTABLE_VERSION || hdr->family != RTABLE_FAMILY_INET) {
+		fprintf(stderr, "[%s] '%s' has unsupported version %u, family %u.\n",
+				__FUNCTION__, path, hdr->version, hdr->family);
+		goto fail;
+	}
+	if (hdr->header_size < sizeof(*hdr) || hdr->header_size % 8 ||
+		hdr->header_size > rt->map_len ||
+		hdr->count != (rt->map_len - hdr->header_size) / sizeof(struct ipv4_range) ||
+		hdr->header_size + hdr->count * sizeof(struct ipv4_range) != rt->map_len) {
+		fprintf(stderr, "[%s] '%s' has a bad size.\n", __FUNCTION__, path);
+		goto fail;
+	}
+
+	rt->hdr = hdr;
+	rt->ranges = (const struct ipv4_range *)((const char *)rt->map_base + hdr->header_size);
+	rt->count = hdr->count;
+
+	if (rtable_crc32(0, rt->ranges, sizeof(struct ipv4_range) * rt->count) != hdr->checksum) {
+		fprintf(stderr, "[%s] '%s' has a bad checksum.\n", __FUNCTION__, path);
+		goto fail;
+	}
+	return 0;
+
+fail:
+	munmap(rt->map_base, rt->map_len);
+	memset(rt, 0, sizeof(*rt));
+	return -EINVAL;
+}
+
+int rtable_build_index(struct rtable *rt)
+{
+	size_t i, h;
+
+	free(rt->bucket);
+	free(rt->starts);
+	rt->bucket = (uint32_t *)malloc(sizeof(uint32_t) * (RTABLE_BUCKETS + 1));
+	rt->starts = (uint32_t *)malloc(sizeof(uint32_t) * (rt->count + RTABLE_STARTS_PAD));
+	if (!rt->bucket || !rt->starts) {
+		free(rt->bucket);
+		free(rt->starts);
+		rt->bucket = rt->starts = NULL;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < rt->count; i++)
+		rt->starts[i] = rt->ranges[i].start;
+	for (i = 0; i < RTABLE_STARTS_PAD; i++)
+		rt->starts[rt->count + i] = 0xffffffff;
+
+	for (h = 0, i = 0; h <= RTABLE_BUCKETS; h++) {
+		while (i < rt->count && (rt->ranges[i].start >> 16) < h)
+			i++;
+		rt->bucket[h] = i;
+	}
+	return 0;
+}
+
+size_t rtable_lookup_batch(const struct rtable *rt, const uint32_t *ips,
+		uint8_t *hits, size_t n)
+{
+	size_t i, nr_hits = 0;
+
+	if (!rt->bucket) {
+		for (i = 0; i < n; i++)
+			nr_hits += (hits[i] = rtable_lookup(rt, ips[i]));
+		return nr_hits;
+	}
+	for (i = 0; i < n; i++)
+		nr_hits += (hits[i] = rtable_lookup_fast(rt, ips[i]));
+	return nr_hits;
+}
+
+void rtable_close(struct rtable *rt)
+{
+	free(rt->bucket);
+	free(rt->starts);
+	if (rt->map_base)
+		munmap(rt->map_base, rt->map_len);
+	memset(rt, 0, sizeof(*rt));
+}
+
+/**
+ * Multi-level direct table, DIR-16-8-8:
+ *  l1[ip >> 16] -> hit, miss, or a block of 256 entries per /24 in l2,
+ *  l2[..][(ip >> 8) & 0xff] -> hit, miss, or a 256-bit bitmap in l3.
+ */
+static int rtable_dir_grow(uint32_t **base, uint32_t nr, uint32_t *size, size_t width)
+{
+	if (nr >= *size) {
+		uint32_t *p;
+		uint32_t new_size = *size ? *size * 2 : 64;
+		if (!(p = realloc(*base, sizeof(uint32_t) * width * new_size)))
+			return -ENOMEM;
+		*base = p;
+		*size = new_size;
+	}
+	return 0;
+}
+
+/* How the ranges from 'j' on cover lo..hi: 0 - not, 1 - fully, 2 - partly */
+static inline int range_coverage(const struct ipv4_range *ranges, size_t count,
+		size_t j, uint32_t lo, uint32_t hi)
+{
+	if (j >= count || ranges[j].start > hi)
+		return 0;
+	if (ranges[j].start <= lo && ranges[j].end >= hi)
+		return 1;
+	return 2;
+}
+
+int rtable_dir_build(struct rtable_dir *rd, const struct ipv4_range *ranges, size_t count)
+{
+	uint32_t l2_size = 0, l3_size = 0, h, m, ip;
+	size_t j = 0;
+
+	memset(rd, 0, sizeof(*rd));
+	if (!(rd->l1 = rd->l1_mem = malloc(sizeof(uint32_t) * RTABLE_DIR_L1)))
+		return -ENOMEM;
+
+	for (h = 0; h < RTABLE_DIR_L1; h++) {
+		uint32_t lo = h << 16, hi = lo | 0xffff;
+		uint32_t *l2;
+		int cov;
+
+		while (j < count && ranges[j].end < lo)
+			j++;
+		if ((cov = range_coverage(ranges, count, j, lo, hi)) < 2) {
+			rd->l1_mem[h] = cov ? RTABLE_DIR_HIT : RTABLE_DIR_MISS;
+			continue;
+		}
+
+		if (rtable_dir_grow(&rd->l2_mem, rd->nr_l2, &l2_size, 256) < 0)
+			goto fail;
+		rd->l1_mem[h] = RTABLE_DIR_CHILD + rd->nr_l2;
+		l2 = rd->l2_mem + 256 * rd->nr_l2++;
+
+		for (m = 0; m < 256; m++) {
+			uint32_t lo2 = lo | (m << 8), hi2 = lo2 | 0xff;
+			uint32_t *l3;
+
+			while (j < count && ranges[j].end < lo2)
+				j++;
+			if ((cov = range_coverage(ranges, count, j, lo2, hi2)) < 2) {
+				l2[m] = cov ? RTABLE_DIR_HIT : RTABLE_DIR_MISS;
+				continue;
+			}
+
+			if (rtable_dir_grow(&rd->l3_mem, rd->nr_l3, &l3_size, 8) < 0)
+				goto fail;
+			l2[m] = RTABLE_DIR_CHILD + rd->nr_l3;
+			l3 = rd->l3_mem + 8 * rd->nr_l3++;
+			memset(l3, 0, sizeof(uint32_t) * 8);
+
+			/* Set the bits of every address covered in this /24 */
+			for (ip = lo2; ; ip++) {
+				while (j < count && ranges[j].end < ip)
+					j++;
+				if (j < count && ranges[j].start <= ip)
+					l3[(ip & 0xff) >> 5] |= (uint32_t)1 << (ip & 31);
+				if (ip == hi2)
+					break;
+			}
+		}
+	}
+
+	rd->l2 = rd->l2_mem;
+	rd->l3 = rd->l3_mem;
+	return 0;
+
+fail:
+	rtable_dir_close(rd);
+	return -ENOMEM;
+}
+
+size_t rtable_dir_size(const struct rtable_dir *rd)
+{
+	return sizeof(struct rtable_dir_header) + sizeof(uint32_t) *
+		((size_t)RTABLE_DIR_L1 + 256 * (size_t)rd->nr_l2 + 8 * (size_t)rd->nr_l3);
+}
+
+int rtable_dir_write(FILE *fp, const struct rtable_dir *rd)
+{
+	struct rtable_dir_header hdr;
+	uint32_t crc;
+
+	crc = rtable_crc32(0, rd->l1, sizeof(uint32_t) * RTABLE_DIR_L1);
+	crc = rtable_crc32(crc, rd->l2, sizeof(uint32_t) * 256 * rd->nr_l2);
+	crc = rtable_crc32(crc, rd->l3, sizeof(uint32_t) * 8 * rd->nr_l3);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = RTABLE_DIR_MAGIC;
+	hdr.version = RTABLE_VERSION;
+	hdr.family = RTABLE_FAMILY_INET;
+	hdr.header_size = sizeof(hdr);
+	hdr.checksum = crc;
+	hdr.nr_l2 = rd->nr_l2;
+	hdr.nr_l3 = rd->nr_l3;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+		fwrite(rd->l1, sizeof(uint32_t), RTABLE_DIR_L1, fp) != RTABLE_DIR_L1 ||
+		fwrite(rd->l2, sizeof(uint32_t) * 256, rd->nr_l2, fp) != rd->nr_l2 ||
+		fwrite(rd->l3, sizeof(uint32_t) * 8, rd->nr_l3, fp) != rd->nr_l3 ||
+		fflush(fp) != 0)
+		return -EIO;
+	return 0;
+}
+
+int rtable_dir_open(struct rtable_dir *rd, const char *path)
+{
+	const struct rtable_dir_header *hdr;
+	const uint32_t *data;
+	uint32_t crc;
+	size_t i;
+	int ret;
+
+	memset(rd, 0, sizeof(*rd));
+
+	if ((ret = rtable_map(path, sizeof(*hdr), &rd->map_base, &rd->map_len)) < 0)
+		return ret;
+
+	hdr = rd->map_base;
+	if (hdr->magic != RTABLE_DIR_MAGIC) {
+		fprintf(stderr, "[%s] '%s' is not a direct table, or of other byte order.\n",
+				__FUNCTION__, path);
+		goto fail;
+	}
+	if (hdr->version != RTABLE_VERSION || hdr->family != RTABLE_FAMILY_INET) {
+		fprintf(stderr, "[%s] '%s' has unsupported version %u, family %u.\n",
+				__FUNCTION__, path, hdr->version, hdr->family);
+		goto fail;
+	}
+	rd->nr_l2 = hdr->nr_l2;
+	rd->nr_l3 = hdr->nr_l3;
+	if (hdr->header_size != sizeof(*hdr) || rd->nr_l2 > RTABLE_DIR_L1 ||
+		rd->nr_l3 > 256 * rd->nr_l2 || rtable_dir_size(rd) != rd->map_len) {
+		fprintf(stderr, "[%s] '%s' has a bad size.\n", __FUNCTION__, path);
+		goto fail;
+	}
+
+	data = (const uint32_t *)((const char *)rd->map_base + hdr->header_size);
+	rd->l1 = data;
+	rd->l2 = rd->l1 + RTABLE_DIR_L1;
+	rd->l3 = rd->l2 + 256 * rd->nr_l2;
+
+	crc = rtable_crc32(0, data, rd->map_len - hdr->header_size);
+	if (crc != hdr->checksum) {
+		fprintf(stderr, "[%s] '%s' has a bad checksum.\n", __FUNCTION__, path);
+		goto fail;
+	}
+	/* Children must lie inside the next level, lookups take them as they are */
+	for (i = 0; i < RTABLE_DIR_L1 + 256 * (size_t)rd->nr_l2; i++) {
+		uint32_t nr = i < RTABLE_DIR_L1 ? rd->nr_l2 : rd->nr_l3;
+		if (data[i] >= RTABLE_DIR_CHILD && data[i] - RTABLE_DIR_CHILD >= nr) {
+			fprintf(stderr, "[%s] '%s' has a bad child index.\n", __FUNCTION__, path);
+			goto fail;
+		}
+	}
+	return 0;
+
+fail:
+	munmap(rd->map_base, rd->map_len);
+	memset(rd, 0, sizeof(*rd));
+	return -EINVAL;
+}
+
+void rtable_dir_close(struct rtable_dir *rd)
+{
+	if (rd->map_base)
+		munmap(rd->map_base, rd->map_len);
+	free(rd->l1_mem);
+	free(rd->l2_mem);
+	free(rd->l3_mem);
+	memset(rd, 0, sizeof(*rd));
+}
@@ -0,0 +1,249 @@
+#ifndef __RTABLE_H
+#define __RTABLE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct ipv4_range {
+	uint32_t start;
+	uint32_t end;
+};
+
+/* Strict dotted quad over a string that is not NUL terminated */
+static inline int ipv4_parse_n(const char *s, size_t len, uint32_t *addr)
+{
+	const char *e = s + len;
+	uint32_t u = 0, b;
+	int i, digits;
+
+	for (i = 0; i < 4; i++) {
+		for (b = 0, digits = 0; s < e && *s >= '0' && *s <= '9'; s++, digits++)
+			b = b * 10 + (*s - '0');
+		if (digits == 0 || digits > 3 || b > 255)
+			return -EINVAL;
+		u = (u << 8) | b;
+		if (i < 3) {
+			if (s >= e || *s != '.')
+				return -EINVAL;
+			s++;
+		}
+	}
+	if (s != e)
+		return -EINVAL;
+	*addr = u;
+	return 0;
+}
+
+/**
+ * Return the prefix length of the largest network that starts at 'net'
+ *  and does not go beyond 'end'.
+ */
+static inline int ipv4_net_bits(uint32_t net, uint32_t end)
+{
+	uint64_t size = net ? (net & -net) : ((uint64_t)1 << 32);
+	int bits = 32;
+
+	while ((uint64_t)net + size - 1 > end)
+		size >>= 1;
+	while (size > 1) {
+		size >>= 1;
+		bits--;
+	}
+	return bits;
+}
+
+static inline uint32_t ipv4_net_last(uint32_t net, int net_bits)
+{
+	return net_bits ? (net | (((uint32_t)1 << (32 - net_bits)) - 1)) : 0xffffffff;
+}
+
+/**
+ * Compiled range table, as written by 'ipv4-merger -o table':
+ *
+ *   struct rtable_header
+ *   struct ipv4_range[count]   sorted, merged, non-overlapping
+ *
+ * Everything is stored in host byte order so that the ranges can be
+ *  used right from the mapped file. A table built on a host with the
+ *  other byte order is rejected by its magic.
+ */
+#define RTABLE_MAGIC      0x52544231  /* "RTB1" */
+#define RTABLE_VERSION    1
+
+#define RTABLE_FAMILY_INET   4
+
+struct rtable_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t family;
+	uint32_t header_size;
+	uint32_t checksum;      /* CRC-32 of the ranges */
+	uint64_t count;         /* number of ranges */
+	uint64_t reserved;
+};
+
+struct rtable {
+	const struct rtable_header *hdr;
+	const struct ipv4_range *ranges;
+	size_t count;
+	void  *map_base;
+	size_t map_len;
+	/* Search index, see rtable_build_index() */
+	uint32_t *bucket;
+	uint32_t *starts;
+};
+
+#define RTABLE_BUCKETS     65536   /* one per /16 */
+#define RTABLE_STARTS_PAD  8
+
+uint32_t rtable_crc32(uint32_t crc, const void *buf, size_t len);
+
+/* Write a table of sorted and merged ranges to 'fp' */
+int rtable_write(FILE *fp, const struct ipv4_range *ranges, size_t count);
+
+/* Map a table file read-only and check it */
+int rtable_open(struct rtable *rt, const char *path);
+void rtable_close(struct rtable *rt);
+
+/**
+ * Build the in-memory search index used by rtable_lookup_fast():
+ *  'bucket[h]' is the number of ranges starting before h.0.0 (as /16),
+ *  'starts' is a copy of the range starts padded with 0xffffffff.
+ */
+int rtable_build_index(struct rtable *rt);
+
+/* Classify 'n' addresses, set 'hits[i]' to 0/1 and return the hit count */
+size_t rtable_lookup_batch(const struct rtable *rt, const uint32_t *ips,
+		uint8_t *hits, size_t n);
+
+/* Return 1 if 'ip' (host byte order) is in the table, 0 otherwise */
+static inline int rtable_lookup(const struct rtable *rt, uint32_t ip)
+{
+	const struct ipv4_range *r = rt->ranges;
+	size_t lo = 0, hi = rt->count;
+
+	/* Find the last range that starts at or before 'ip' */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (r[mid].start <= ip)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo > 0 && ip <= r[lo - 1].end;
+}
+
+/**
+ * Count how many of the 8 sorted values at 'p' are <= ip, without
+ *  branches. Values beyond the bucket are larger than 'ip' anyway.
+ */
+static inline unsigned rtable_count_le8(const uint32_t *p, uint32_t ip)
+{
+#ifdef __SSE2__
+	const __m128i bias = _mm_set1_epi32(0x80000000);
+	__m128i key = _mm_xor_si128(_mm_set1_epi32(ip), bias);
+	__m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i *)p), bias);
+	__m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + 4)), bias);
+	int gt = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(a, key))) |
+			 _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(b, key))) << 4;
+	return 8 - __builtin_popcount(gt);
+#else
+	unsigned c = 0, i;
+	for (i = 0; i < 8; i++)
+		c += p[i] <= ip;
+	return c;
+#endif
+}
+
+/* Same as rtable_lookup(), using the index from rtable_build_index() */
+static inline int rtable_lookup_fast(const struct rtable *rt, uint32_t ip)
+{
+	uint32_t h = ip >> 16;
+	const uint32_t *base = rt->starts + rt->bucket[h];
+	size_t n = rt->bucket[h + 1] - rt->bucket[h], c;
+
+	/* Branch-free halving until at most 8 candidates are left */
+	while (n > 8) {
+		size_t half = n / 2;
+		base = base[half] <= ip ? base + half : base;
+		n -= half;
+	}
+	c = rtable_count_le8(base, ip);
+	if (c > n)
+		c = n;  /* only the 0xffffffff padding can get here */
+	c += base - rt->starts;
+
+	return c > 0 && ip <= rt->ranges[c - 1].end;
+}
+
+/**
+ * Multi-level direct table (DIR-16-8-8), as written by 'ipv4-merger -o dir':
+ *
+ *   struct rtable_dir_header
+ *   uint32_t l1[65536]          one entry per /16
+ *   uint32_t l2[nr_l2][256]     one entry per /24 of partly covered /16s
+ *   uint32_t l3[nr_l3][8]       one bit per address of partly covered /24s
+ *
+ * An entry is RTABLE_DIR_MISS, RTABLE_DIR_HIT, or RTABLE_DIR_CHILD plus
+ *  the index of the block on the next level. A lookup reads at most
+ *  three words, at the price of a 256 KiB first level.
+ */
+#define RTABLE_DIR_MAGIC  0x52544431  /* "RTD1" */
+
+#define RTABLE_DIR_L1     65536
+#define RTABLE_DIR_MISS   0
+#define RTABLE_DIR_HIT    1
+#define RTABLE_DIR_CHILD  2
+
+struct rtable_dir_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t family;
+	uint32_t header_size;
+	uint32_t checksum;      /* CRC-32 of everything after the header */
+	uint32_t nr_l2;
+	uint32_t nr_l3;
+	uint64_t reserved;
+};
+
+struct rtable_dir {
+	const uint32_t *l1;
+	const uint32_t *l2;
+	const uint32_t *l3;
+	uint32_t nr_l2;
+	uint32_t nr_l3;
+	void  *map_base;
+	size_t map_len;
+	/* Set when built in memory */
+	uint32_t *l1_mem;
+	uint32_t *l2_mem;
+	uint32_t *l3_mem;
+};
+
+/* Build a direct table in memory from sorted and merged ranges */
+int rtable_dir_build(struct rtable_dir *rd, const struct ipv4_range *ranges, size_t count);
+int rtable_dir_write(FILE *fp, const struct rtable_dir *rd);
+/* Size of the table in bytes, as a file or in memory */
+size_t rtable_dir_size(const struct rtable_dir *rd);
+
+int rtable_dir_open(struct rtable_dir *rd, const char *path);
+void rtable_dir_close(struct rtable_dir *rd);
+
+static inline int rtable_dir_lookup(const struct rtable_dir *rd, uint32_t ip)
+{
+	uint32_t v = rd->l1[ip >> 16];
+
+	if (v < RTABLE_DIR_CHILD)
+		return v;
+	v = rd->l2[256 * (v - RTABLE_DIR_CHILD) + ((ip >> 8) & 0xff)];
+	if (v < RTABLE_DIR_CHILD)
+		return v;
+	return (rd->l3[8 * (v - RTABLE_DIR_CHILD) + ((ip & 0xff) >> 5)] >> (ip & 31)) & 1;
+}
+
+#endif /* __RTABLE_H */
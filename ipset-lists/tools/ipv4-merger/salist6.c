@@ -0,0 +1,448 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "salist6.h"
+#include "ipsetsize.h"
+
+#define IPV6_RADIX_MIN 64   /* qsort() below this */
+
+static const struct ipv6_addr ipv6_addr_max = { ~(uint64_t)0, ~(uint64_t)0 };
+
+int ipv6_parse_n(const char *s, size_t len, struct ipv6_addr *addr)
+{
+	char buf[INET6_ADDRSTRLEN];
+	uint8_t b[16];
+	int i;
+
+	if (len >= sizeof(buf))
+		return -EINVAL;
+	memcpy(buf, s, len);
+	buf[len] = '\0';
+	if (inet_pton(AF_INET6, buf, b) != 1)
+		return -EINVAL;
+
+	addr->hi = addr->lo = 0;
+	for (i = 0; i < 8; i++) {
+		addr->hi = (addr->hi << 8) | b[i];
+		addr->lo = (addr->lo << 8) | b[i + 8];
+	}
+	return 0;
+}
+
+char *ipv6_addr_tos(const struct ipv6_addr *addr, char *s, size_t size)
+{
+	uint8_t b[16];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		b[i] = addr->hi >> (56 - 8 * i);
+		b[i + 8] = addr->lo >> (56 - 8 * i);
+	}
+	return (char *)inet_ntop(AF_INET6, b, s, size);
+}
+
+/* Mask with the lowest 'host_bits' bits set */
+static inline struct ipv6_addr ipv6_host_mask(int host_bits)
+{
+	struct ipv6_addr m;
+
+	if (host_bits >= 128) {
+		m.hi = m.lo = ~(uint64_t)0;
+	} else if (host_bits > 64) {
+		m.hi = ((uint64_t)1 << (host_bits - 64)) - 1;
+		m.lo = ~(uint64_t)0;
+	} else {
+		m.hi = 0;
+		m.lo = host_bits == 64 ? ~(uint64_t)0 : ((uint64_t)1 << host_bits) - 1;
+	}
+	return m;
+}
+
+static inline int ipv6_trailing_zeros(const struct ipv6_addr *a)
+{
+	if (a->lo)
+		return __builtin_ctzll(a->lo);
+	if (a->hi)
+		return 64 + __builtin_ctzll(a->hi);
+	return 128;
+}
+
+static inline void ipv6_addr_inc(struct ipv6_addr *a)
+{
+	if (++a->lo == 0)
+		a->hi++;
+}
+
+/**
+ * Return the prefix length of the largest network that starts at 'net'
+ *  and does not go beyond 'end', and its last address in 'last'.
+ */
+static int ipv6_net_bits(const struct ipv6_addr *net, const struct ipv6_addr *end,
+		struct ipv6_addr *last)
+{
+	int host_bits = ipv6_trailing_zeros(net);
+
+	for (;;) {
+		struct ipv6_addr m = ipv6_host_mask(host_bits);
+		last->hi = net->hi | m.hi;
+		last->lo = net->lo | m.lo;
+		if (ipv6_addr_cmp(last, end) <= 0)
+			return 128 - host_bits;
+		host_bits--;
+	}
+}
+
+struct sa6_open_data *salist6_open(void)
+{
+	struct sa6_open_data *od;
+
+	od = (struct sa6_open_data *)malloc(sizeof(*od));
+	if (!od) {
+		fprintf(stderr, "salist: cannot allocate sa6_open_data.\n");
+		return NULL;
+	}
+	memset(od, 0, sizeof(*od));
+	return od;
+}
+
+void salist6_free(struct sa6_open_data *od)
+{
+	free(od->tmp_base);
+	free(od);
+}
+
+int ipv6_list_add_range(struct sa6_open_data *od, const struct ipv6_addr *start,
+		const struct ipv6_addr *end)
+{
+	struct ipv6_range *cur;
+
+	if (od->tmp_length >= od->tmp_size) {
+		size_t new_size = od->tmp_size < 100 ? 100 : od->tmp_size * 2;
+		struct ipv6_range *new_base = (struct ipv6_range *)realloc(od->tmp_base,
+				sizeof(struct ipv6_range) * new_size);
+		if (!new_base)
+			return -ENOMEM;
+		od->tmp_base = new_base;
+		od->tmp_size = new_size;
+	}
+
+	cur = &od->tmp_base[od->tmp_length++];
+	cur->start = *start;
+	cur->end = *end;
+	return 0;
+}
+
+int ipv6_list_add_net(struct sa6_open_data *od, const struct ipv6_addr *net,
+		int net_bits)
+{
+	struct ipv6_addr m = ipv6_host_mask(128 - net_bits), start, end;
+
+	start.hi = net->hi & ~m.hi;
+	start.lo = net->lo & ~m.lo;
+	end.hi = net->hi | m.hi;
+	end.lo = net->lo | m.lo;
+	return ipv6_list_add_range(od, &start, &end);
+}
+
+int salist6_cmd_parse_n(struct sa6_open_data *od, const char *s, size_t len)
+{
+	const char *sep, *p, *end = s + len;
+	struct ipv6_addr a1, a2;
+	long n;
+
+	if ((sep = memchr(s, '/', len))) {
+		/* 2001:250::/35 */
+		for (n = 0, p = sep + 1; p < end && *p >= '0' && *p <= '9' && n <= 128; p++)
+			n = n * 10 + (*p - '0');
+		if (ipv6_parse_n(s, sep - s, &a1) < 0 || p == sep + 1 || p != end || n > 128)
+			goto invalid;
+		return ipv6_list_add_net(od, &a1, (int)n);
+	} else if ((sep = memchr(s, '-', len))) {
+		/* 2001:250::-2001:250::ffff */
+		if (ipv6_parse_n(s, sep - s, &a1) < 0 ||
+			ipv6_parse_n(sep + 1, end - sep - 1, &a2) < 0)
+			goto invalid;
+		if (ipv6_addr_cmp(&a1, &a2) > 0)
+			return ipv6_list_add_range(od, &a2, &a1);
+		return ipv6_list_add_range(od, &a1, &a2);
+	} else {
+		if (ipv6_parse_n(s, len, &a1) < 0)
+			goto invalid;
+		return ipv6_list_add_range(od, &a1, &a1);
+	}
+
+invalid:
+	fprintf(stderr, "Invalid IPv6 network or range '%.*s'.\n", (int)len, s);
+	od->errors++;
+	return -EINVAL;
+}
+
+int salist6_parse_buf(struct sa6_open_data *od, const char *data, size_t len)
+{
+	const char *p, *end = data + len, *eol, *e;
+	int ret;
+
+	for (p = data; p < end; p = eol + 1) {
+		if (!(eol = memchr(p, '\n', end - p)))
+			eol = end;
+		for (; p < eol && (*p == ' ' || *p == '\t'); p++)
+			;
+		for (e = eol; e > p && (e[-1] == '\r' || e[-1] == ' ' || e[-1] == '\t'); e--)
+			;
+		if (p == e || *p == '#')
+			continue;
+		if (*p == 'c' && e - p >= 7 && memcmp(p, "create ", 7) == 0)
+			continue;
+		/* Entries of ipset restore files: "add <set> <entry>" */
+		if (*p == 'a' && e - p >= 4 && memcmp(p, "add ", 4) == 0) {
+			const char *entry = memchr(p + 4, ' ', e - p - 4);
+			if (entry)
+				p = entry + 1;
+		}
+		if ((ret = salist6_cmd_parse_n(od, p, e - p)) < 0 && ret != -EINVAL)
+			return ret;
+	}
+	return 0;
+}
+
+static int ipv6_range_sort_cmp(const void *a, const void *b)
+{
+	const struct ipv6_range *ra = a, *rb = b;
+	int r = ipv6_addr_cmp(&ra->start, &rb->start);
+
+	return r ? r : ipv6_addr_cmp(&ra->end, &rb->end);
+}
+
+/* Byte 'b' of 'start', from the most significant one */
+static inline unsigned ipv6_range_digit(const struct ipv6_range *r, int b)
+{
+	return (b < 8 ? r->start.hi >> (56 - 8 * b) : r->start.lo >> (120 - 8 * b)) & 0xff;
+}
+
+/**
+ * In place MSD radix sort by 'start', a byte a level: the ranges are
+ *  permuted into their 256 buckets by swapping (American flag sort), and
+ *  each bucket is sorted on the next byte, or by qsort() once small. Keys
+ *  of 16 bytes take no second buffer like the LSD sort of rsort.c would.
+ */
+static void ipv6_range_radix_sort(struct ipv6_range *r, size_t n, int b)
+{
+	size_t count[256], next[256], last[256], pos;
+	unsigned d, k;
+
+	for (; b < 16; b++) {
+		if (n < IPV6_RADIX_MIN) {
+			qsort(r, n, sizeof(*r), ipv6_range_sort_cmp);
+			return;
+		}
+		memset(count, 0, sizeof(count));
+		for (pos = 0; pos < n; pos++)
+			count[ipv6_range_digit(&r[pos], b)]++;
+		/* Same byte in all of them, go on with the next */
+		if (count[ipv6_range_digit(&r[0], b)] < n)
+			break;
+	}
+	if (b >= 16)
+		return;
+
+	for (pos = 0, d = 0; d < 256; d++) {
+		next[d] = pos;
+		pos += count[d];
+		last[d] = pos;
+	}
+	for (d = 0; d < 256; d++) {
+		while (next[d] < last[d]) {
+			k = ipv6_range_digit(&r[next[d]], b);
+			if (k == d) {
+				next[d]++;
+			} else {
+				struct ipv6_range t = r[next[d]];
+				r[next[d]] = r[next[k]];
+				r[next[k]++] = t;
+			}
+		}
+	}
+	for (pos = 0, d = 0; d < 256; pos += count[d], d++) {
+		if (count[d] >= 2)
+			ipv6_range_radix_sort(r + pos, count[d], b + 1);
+	}
+}
+
+static int salist6_is_sorted(const struct sa6_open_data *od)
+{
+	size_t i;
+
+	for (i = 1; i < od->tmp_length; i++) {
+		if (ipv6_addr_cmp(&od->tmp_base[i - 1].start, &od->tmp_base[i].start) > 0)
+			return 0;
+	}
+	return 1;
+}
+
+int salist6_close(struct sa6_open_data *od)
+{
+	size_t ri, wi;
+
+	if (od->tmp_length >= 2) {
+		if (!salist6_is_sorted(od))
+			ipv6_range_radix_sort(od->tmp_base, od->tmp_length, 0);
+
+		for (wi = 0, ri = 1; ri < od->tmp_length; ri++) {
+			struct ipv6_range *w = &od->tmp_base[wi], *r = &od->tmp_base[ri];
+			struct ipv6_addr next = w->end;
+
+			/* NOTICE: the last address has no successor */
+			if (ipv6_addr_cmp(&w->end, &ipv6_addr_max) == 0)
+				continue;
+			ipv6_addr_inc(&next);
+			if (ipv6_addr_cmp(&r->start, &next) <= 0) {
+				if (ipv6_addr_cmp(&r->end, &w->end) > 0)
+					w->end = r->end;
+			} else {
+				wi++;
+				if (wi < ri)
+					od->tmp_base[wi] = *r;
+			}
+		}
+		od->tmp_length = wi + 1;
+	}
+
+	/* Reduce the size in place */
+	if (od->tmp_length && od->tmp_length < od->tmp_size) {
+		struct ipv6_range *p = (struct ipv6_range *)realloc(od->tmp_base,
+				sizeof(struct ipv6_range) * od->tmp_length);
+		if (p) {
+			od->tmp_base = p;
+			od->tmp_size = od->tmp_length;
+		}
+	}
+
+	if (od->errors) {
+		fprintf(stderr, "[%s] %d errors detected during table operation.\n",
+				__FUNCTION__, od->errors);
+	}
+	return 0;
+}
+
+int salist6_add_filtered(struct sa6_open_data *od, struct sa6_open_data *src,
+		int max_bits)
+{
+	size_t i;
+	int ret;
+
+	/* Nothing left out, the ranges will do */
+	if (max_bits >= 128) {
+		for (i = 0; i < src->tmp_length; i++) {
+			if ((ret = ipv6_list_add_range(od, &src->tmp_base[i].start,
+					&src->tmp_base[i].end)) < 0)
+				return ret;
+		}
+		return 0;
+	}
+
+	for (i = 0; i < src->tmp_length; i++) {
+		struct ipv6_addr net = src->tmp_base[i].start, last;
+		const struct ipv6_addr *end = &src->tmp_base[i].end;
+		for (;;) {
+			int bits = ipv6_net_bits(&net, end, &last);
+			if (bits <= max_bits && (ret = ipv6_list_add_range(od, &net, &last)) < 0)
+				return ret;
+			if (ipv6_addr_cmp(&last, end) >= 0)
+				break;
+			net = last;
+			ipv6_addr_inc(&net);
+		}
+	}
+	return 0;
+}
+
+int salist6_move(struct sa6_open_data *od, struct sa6_open_data *src)
+{
+	int ret;
+
+	if (od->tmp_length) {
+		ret = salist6_add_filtered(od, src, 128);
+		free(src->tmp_base);
+	} else {
+		free(od->tmp_base);
+		od->tmp_base = src->tmp_base;
+		od->tmp_size = src->tmp_size;
+		od->tmp_length = src->tmp_length;
+		ret = 0;
+	}
+	src->tmp_base = NULL;
+	src->tmp_size = src->tmp_length = 0;
+	return ret;
+}
+
+size_t salist6_prefix_histogram(const struct sa6_open_data *od, size_t *hist)
+{
+	size_t i, nr = 0;
+
+	memset(hist, 0, sizeof(size_t) * 129);
+	for (i = 0; i < od->tmp_length; i++) {
+		struct ipv6_addr net = od->tmp_base[i].start, last;
+		const struct ipv6_addr *end = &od->tmp_base[i].end;
+		for (;;) {
+			hist[ipv6_net_bits(&net, end, &last)]++;
+			nr++;
+			if (ipv6_addr_cmp(&last, end) >= 0)
+				break;
+			net = last;
+			ipv6_addr_inc(&net);
+		}
+	}
+	return nr;
+}
+
+void sa6_open_data_dump(struct sa6_open_data *od, int as_ranges,
+		const char *set_name, const char *new_name)
+{
+	char s1[INET6_ADDRSTRLEN], s2[INET6_ADDRSTRLEN];
+	uint32_t hashsize = 0, maxelem = 0;
+	size_t i, hist[129];
+
+	if (set_name)
+		ipset_hash_size(salist6_prefix_histogram(od, hist), &hashsize, &maxelem);
+	if (new_name) {
+		/* Not a leftover of a failed run, whatever its sizes */
+		printf("destroy %s -exist\n", new_name);
+		printf("create %s hash:net family inet6 hashsize %u maxelem %u\n",
+			new_name, hashsize, maxelem);
+	} else if (set_name) {
+		printf("create %s hash:net family inet6 hashsize %u maxelem %u\n",
+			set_name, hashsize, maxelem);
+	}
+
+	for (i = 0; i < od->tmp_length; i++) {
+		struct ipv6_addr net = od->tmp_base[i].start, last;
+		const struct ipv6_addr *end = &od->tmp_base[i].end;
+
+		if (as_ranges) {
+			printf("%s-%s\n", ipv6_addr_tos(&net, s1, sizeof(s1)),
+				ipv6_addr_tos(end, s2, sizeof(s2)));
+			continue;
+		}
+		for (;;) {
+			int bits = ipv6_net_bits(&net, end, &last);
+			if (set_name)
+				printf("add %s %s/%d\n", new_name ? new_name : set_name,
+					ipv6_addr_tos(&net, s1, sizeof(s1)), bits);
+			else
+				printf("%s/%d\n", ipv6_addr_tos(&net, s1, sizeof(s1)), bits);
+			if (ipv6_addr_cmp(&last, end) >= 0)
+				break;
+			net = last;
+			ipv6_addr_inc(&net);
+		}
+	}
+
+	if (new_name) {
+		printf("swap %s %s\n", new_name, set_name);
+		printf("destroy %s\n", new_name);
+	}
+}
@@ -0,0 +1,74 @@
+#ifndef __SALIST6_H
+#define __SALIST6_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * IPv6 counterpart of the IPv4 range lists in ipv4-merger.c. A 128-bit
+ *  address is kept as two host order 64-bit halves, which compares and
+ *  sorts fast on 32-bit targets too, where no native 128-bit type is.
+ */
+struct ipv6_addr {
+	uint64_t hi;
+	uint64_t lo;
+};
+
+struct ipv6_range {
+	struct ipv6_addr start;
+	struct ipv6_addr end;
+};
+
+struct sa6_open_data {
+	struct ipv6_range *tmp_base;
+	size_t tmp_size;
+	size_t tmp_length;
+	int    errors;
+};
+
+static inline int ipv6_addr_cmp(const struct ipv6_addr *a, const struct ipv6_addr *b)
+{
+	if (a->hi != b->hi)
+		return a->hi < b->hi ? -1 : 1;
+	if (a->lo != b->lo)
+		return a->lo < b->lo ? -1 : 1;
+	return 0;
+}
+
+int ipv6_parse_n(const char *s, size_t len, struct ipv6_addr *addr);
+char *ipv6_addr_tos(const struct ipv6_addr *addr, char *s, size_t size);
+
+struct sa6_open_data *salist6_open(void);
+int salist6_close(struct sa6_open_data *od);
+void salist6_free(struct sa6_open_data *od);
+
+int ipv6_list_add_range(struct sa6_open_data *od, const struct ipv6_addr *start,
+		const struct ipv6_addr *end);
+int ipv6_list_add_net(struct sa6_open_data *od, const struct ipv6_addr *net,
+		int net_bits);
+
+/* Parse "address", "address/prefix_len" or "address-address" */
+int salist6_cmd_parse_n(struct sa6_open_data *od, const char *s, size_t len);
+/**
+ * Parse a buffer of entries, one per line, as salist_parse_buf() does the
+ *  IPv4 ones; return 0, or -ENOMEM, invalid entries count in 'od->errors'.
+ */
+int salist6_parse_buf(struct sa6_open_data *od, const char *data, size_t len);
+
+/* Count the networks by prefix length, 'hist' has 129 slots; return the total */
+size_t salist6_prefix_histogram(const struct sa6_open_data *od, size_t *hist);
+
+/* Append the networks of 'src' no longer than /max_bits to 'od' */
+int salist6_add_filtered(struct sa6_open_data *od, struct sa6_open_data *src,
+		int max_bits);
+/* Append all of 'src' to 'od', taking its array if 'od' is empty; 'src' is left empty */
+int salist6_move(struct sa6_open_data *od, struct sa6_open_data *src);
+
+/**
+ * Print as ranges, as networks, or as an ipset restore script if 'set_name';
+ *  with 'new_name', the script fills that set and swaps it with 'set_name'.
+ */
+void sa6_open_data_dump(struct sa6_open_data *od, int as_ranges,
+		const char *set_name, const char *new_name);
+
+#endif /* __SALIST6_H */
@@ -18,6 +18,9 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.  */
 
 #include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -26,15 +29,18 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
 #include "errors.h"
 
 struct addrmask {
   u_int32_t neta;
   u_int32_t mask;
-  struct addrmask *next;
-  struct addrmask *prev;
 };
 
+/* options with no short form */
+#define OPT_STATS 256
+
 struct option longopts[] = {
   { "version",	0, 0, 'v' },
   { "help",	0, 0, 'h' },
@@ -47,8 +53,11 @@ struct option longopts[] = {
   { "octal",	0, 0, 'o' },
   { "binary",	0, 0, 'b' },
   { "nodns",	0, 0, 'n' },
+  { "file",	1, 0, 'f' },
   { "max",	1, 0, 'M' },
   { "min",	1, 0, 'm' },
+  { "policy",	1, 0, 'p' },
+  { "stats",	2, 0, OPT_STATS },
   { NULL,	0, 0, 0   }
 };
 
@@ -56,31 +65,77 @@ typedef enum {
   OUT_STD, OUT_CIDR, OUT_CISCO, OUT_RANGE, OUT_HEX, OUT_OCTAL, OUT_BINARY
 } output_t;
 
+/* what aggregate() does with blocks longer than --max */
+typedef enum {
+  POL_DROP, POL_MERGE
+} policy_t;
+
 int spectoaml(char *, int);
+int filetoaml(const char *, int);
 int display(output_t);
 int addtoaml(u_int32_t addr, u_int32_t mask);
+int aggregate(u_int32_t, u_int32_t, policy_t);
 static u_int32_t mspectou32(char *);
+static double now(void);
+static void printstats(FILE *);
+
+/* what --stats reports, the times are per phase */
+typedef enum {
+  PH_PARSE, PH_SORT, PH_MERGE, PH_EMIT, PH_NUM
+} phase_t;
+
+static struct {
+  size_t lines, specs, ranges_in, ranges_merged, dropped;
+  size_t hist[33];
+  u_int64_t addresses;
+  double t[PH_NUM], start;
+  char **files;
+  int nfiles;
+  size_t *file_lines, *file_specs;
+} stats;
 
 char version[] = "netmask, version "VERSION;
 char vversion[] = __DATE__" "__TIME__;
 char usage[] = "Try `%s --help' for more information.\n";
 char *progname = NULL;
 static struct addrmask *aml;
+static size_t aml_len = 0, aml_size = 0;
 
 int main(int argc, char *argv[]) {
-  int optc, h = 0, v = 0, debug = 0, dns = 1, lose = 0;
-//  u_int32_t min = ~0, max = 0;
+  int optc, h = 0, v = 0, debug = 0, dns = 1, lose = 0, dostats = 0;
+  char **files = NULL, *statspath = NULL;
+  int nfiles = 0, i;
+  size_t lines, specs;
+  double t;
+  FILE *fp;
+  u_int32_t min = 0, max = ~0;
   output_t output = OUT_CIDR;
+  policy_t policy = POL_DROP;
 
   progname = argv[0];
+  stats.start = now();
   initerrors(progname, 0, 0); /* stderr, nostatus */
-  while((optc = getopt_long(argc, argv, "shoxdrvbincM:m:", longopts,
+  while((optc = getopt_long(argc, argv, "shoxdrvbincf:M:m:p:", longopts,
     (int *) NULL)) != EOF) switch(optc) {
    case 'h': h = 1;   break;
    case 'v': v++;     break;
    case 'n': dns = 0; break;
-//   case 'M': max = mspectou32(optarg); break;
-//   case 'm': min = mspectou32(optarg); break;
+   case 'f':
+    if((files = (char **)realloc(files, sizeof(char *) * (nfiles + 1))) == NULL)
+      panic("malloc failure");
+    files[nfiles++] = optarg;
+    break;
+   case 'M': max = mspectou32(optarg); break;
+   case 'm': min = mspectou32(optarg); break;
+   case 'p':
+    if(strcmp(optarg, "drop") == 0) policy = POL_DROP;
+    else if(strcmp(optarg, "merge") == 0) policy = POL_MERGE;
+    else panic("unknown policy \"%s\"", optarg);
+    break;
+   case OPT_STATS:
+    dostats = 1;
+    statspath = optarg;
+    break;
    case 'd':
     initerrors(NULL, -1, 1); /* showstatus */
     debug = 1;
@@ -103,6 +158,7 @@ int main(int argc, char *argv[]) {
     fprintf(stderr,
       "This is netmask, an address netmask generation utility\n"
       "Usage: %s spec [spec ...]\n"
+      "       %s -f file [spec ...]\n"
       "  -h, --help\t\t\tPrint a summary of the options\n"
       "  -v, --version\t\t\tPrint the version number\n"
       "  -d, --debug\t\t\tPrint status/progress information\n"
@@ -114,8 +170,13 @@ int main(int argc, char *argv[]) {
       "  -o, --octal\t\t\tOutput address/netmask pairs in octal\n"
       "  -b, --binary\t\t\tOutput address/netmask pairs in binary\n"
       "  -n, --nodns\t\t\tDisable DNS lookups for addresses\n"
-//      "  -M, --max mask\t\tLimit maximum mask size\n"
-//      "  -m, --min mask\t\tLimit minimum mask size (drop small ranges)\n"
+      "  -f, --file file\t\tRead specs from file, '-' for stdin\n"
+      "  -M, --max mask\t\tLimit maximum mask size (smallest block)\n"
+      "  -m, --min mask\t\tLimit minimum mask size, splitting larger blocks\n"
+      "  -p, --policy drop|merge\tDrop blocks smaller than --max (default),\n"
+      "\t\t\t\tor widen them to the enclosing --max block\n"
+      "      --stats[=file]\t\tWrite counts and phase times as JSON\n"
+      "\t\t\t\tto file (default: stderr)\n"
       "Definitions:\n"
       "  a spec can be any of:\n"
       "    address\n"
@@ -128,24 +189,111 @@ int main(int argc, char *argv[]) {
       "    0xN\t\thex number\n"
       "    N.N.N.N\tdotted quad\n"
       "    hostname\tdns domain name\n"
-      "  a mask is the number of bits set to one from the left\n", progname);
+      "  a mask is the number of bits set to one from the left\n"
+      "  specs in a file are separated by spaces or newlines\n",
+      progname, progname);
     exit(0);
   }
-  if(lose || optind == argc) {
+  if(min & ~max) panic("--min is longer than --max");
+  if(lose || (optind == argc && !nfiles)) {
     fprintf(stderr, usage, progname);
     exit(1);
   }
+  if(dostats) {
+    stats.files = files;
+    stats.nfiles = nfiles;
+    if((stats.file_lines = (size_t *)calloc(nfiles + 1, sizeof(size_t))) == NULL ||
+       (stats.file_specs = (size_t *)calloc(nfiles + 1, sizeof(size_t))) == NULL)
+      panic("malloc failure");
+  }
+  t = now();
+  for(i = 0; i < nfiles; i++) {
+    lines = stats.lines;
+    specs = stats.specs;
+    filetoaml(files[i], dns);
+    if(dostats) {
+      stats.file_lines[i] = stats.lines - lines;
+      stats.file_specs[i] = stats.specs - specs;
+    }
+  }
   while(optind < argc) spectoaml(argv[optind++], dns);
+  stats.t[PH_PARSE] = now() - t;
+  aggregate(min, max, policy);
+  t = now();
   display(output);
+  fflush(stdout);
+  stats.t[PH_EMIT] = now() - t;
+  if(dostats) {
+    fp = stderr;
+    if(statspath && strcmp(statspath, "-") && (fp = fopen(statspath, "w")) == NULL)
+      panic("unable to open \"%s\"", statspath);
+    printstats(fp);
+    if(fp != stderr) fclose(fp);
+  }
   return(0);
 }
 
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void jsonstr(FILE *fp, const char *str) {
+  fputc('"', fp);
+  for(; *str; str++) {
+    if(*str == '"' || *str == '\\') fprintf(fp, "\\%c", *str);
+    else if((unsigned char)*str < 0x20) fprintf(fp, "\\u%04x", *str);
+    else fputc(*str, fp);
+  }
+  fputc('"', fp);
+}
+
+/* printstats - the --stats report as one JSON object, e.g.
+ * {"files": [{"path": "-", "lines": 4, "parsed": 4}],
+ *  "lines": 4, "parsed": 4, "rejected": 0, "ranges_in": 4, "ranges_merged": 2,
+ *  "dropped": 0, "cidrs": 3, "prefix_lengths": {"24": 2, "32": 1},
+ *  "addresses": 513, "time_ms": {"parse": 0.1, ..., "total": 0.4}}
+ * invalid specs stop netmask, so none are ever rejected */
+static void printstats(FILE *fp) {
+  static const char *phases[PH_NUM] = { "parse", "sort", "merge", "emit" };
+  size_t i, cidrs = 0;
+  const char *sep = "";
+
+  fprintf(fp, "{\"files\": [");
+  for(i = 0; i < (size_t)stats.nfiles; i++) {
+    fprintf(fp, "%s{\"path\": ", i ? ", " : "");
+    jsonstr(fp, stats.files[i]);
+    fprintf(fp, ", \"lines\": %lu, \"parsed\": %lu}",
+      (unsigned long)stats.file_lines[i], (unsigned long)stats.file_specs[i]);
+  }
+  fprintf(fp, "],\n \"lines\": %lu, \"parsed\": %lu, \"rejected\": 0, "
+    "\"ranges_in\": %lu, \"ranges_merged\": %lu, \"dropped\": %lu,\n",
+    (unsigned long)stats.lines, (unsigned long)stats.specs,
+    (unsigned long)stats.ranges_in, (unsigned long)stats.ranges_merged,
+    (unsigned long)stats.dropped);
+  for(i = 0; i <= 32; i++) cidrs += stats.hist[i];
+  fprintf(fp, " \"cidrs\": %lu, \"prefix_lengths\": {", (unsigned long)cidrs);
+  for(i = 0; i <= 32; i++) {
+    if(!stats.hist[i]) continue;
+    fprintf(fp, "%s\"%lu\": %lu", sep, (unsigned long)i, (unsigned long)stats.hist[i]);
+    sep = ", ";
+  }
+  fprintf(fp, "}, \"addresses\": %llu,\n \"time_ms\": {",
+    (unsigned long long)stats.addresses);
+  for(i = 0; i < PH_NUM; i++)
+    fprintf(fp, "\"%s\": %.1f, ", phases[i], stats.t[i] * 1e3);
+  fprintf(fp, "\"total\": %.1f}}\n", (now() - stats.start) * 1e3);
+}
+
 /**************************************
  * PART I - Read input                *
  **************************************/
 
 static u_int32_t aspectou32(char *, int);
 static int       rangetoaml(u_int32_t, u_int32_t);
+static int       addtoarl(u_int32_t, u_int32_t);
 static int       strtou32(u_int32_t *, char *);
 #ifndef HAVE_STRTOUL
 static u_int32_t strtoul(const char *nptr, char **endptr, int base);
@@ -161,6 +309,7 @@ int spectoaml(char *addrspec, int dns) {
   char *sep;
   u_int32_t addr;
 
+  stats.specs++;
   if((sep = strchr(addrspec, ':')) != NULL) {		/* range */
     u_int32_t addr2;
 
@@ -185,6 +334,47 @@ int spectoaml(char *addrspec, int dns) {
   }
   return(0);
 }
+/* filetoaml adds every spec found in a file ("-" for stdin)
+ * specs are separated by any whitespace, as xargs would split them,
+ * and are read in large blocks rather than line by line */
+int filetoaml(const char *path, int dns) {
+  static char buf[65536];
+  size_t len = 0, start, i;
+  ssize_t n;
+  int fd;
+
+  if(strcmp(path, "-") == 0) fd = STDIN_FILENO;
+  else if((fd = open(path, O_RDONLY)) < 0) panic("unable to open \"%s\"", path);
+  for(;;) {
+    if((n = read(fd, buf + len, sizeof(buf) - 1 - len)) < 0) {
+      if(errno == EINTR) continue;
+      panic("unable to read \"%s\"", path);
+    }
+    len += n;
+    for(start = i = 0; i < len; i++) {
+      if(!isspace((unsigned char)buf[i])) continue;
+      if(buf[i] == '\n') stats.lines++;
+      if(i > start) {
+        buf[i] = '\0';
+        spectoaml(buf + start, dns);
+      }
+      start = i + 1;
+    }
+    if(n == 0) {
+      if(start < len) {
+        buf[len] = '\0';
+        spectoaml(buf + start, dns);
+        stats.lines++;
+      }
+      break;
+    }
+    memmove(buf, buf + start, len - start);
+    len -= start;
+    if(len == sizeof(buf) - 1) panic("spec too long in \"%s\"", path);
+  }
+  if(fd != STDIN_FILENO) close(fd);
+  return(0);
+}
 /* aspectou32 should convert the address portion of a spec...
  * "base10"
  * "0base8"
@@ -254,25 +444,17 @@ static int strtou32(u_int32_t *num, char *istr) {
   return(1);
 }
 /* range to aml should take two addresses
- * and add the shortest list of address/mask pairs between them */
+ * and add the range between them, aggregate() later turns it
+ * into the shortest list of address/mask pairs */
 static int rangetoaml(u_int32_t low, u_int32_t high) {
-  u_int32_t i, j, lxh;
+  u_int32_t i;
 
   if(low > high) {
   	i = low;
   	low = high;
   	high = i;
   }
-  for(lxh = i = low ^ high; i & 1; i >>= 1);
-  if(i == 0 && (low | lxh) == high) addtoaml(low, ~(high - low));
-  else {
-    for(i = lxh, j = 0; i >> 1; j++) i >>= 1;
-    i <<= j;
-    i = ~(i - 1) & high;
-    rangetoaml(low, i - 1);
-    rangetoaml(i, high);
-  }
-  return(0);
+  return(addtoarl(low, high));
 }
 #ifndef HAVE_STRTOUL
 #warning no ISO 9899 strtoul()? enabling sub-optimal workaround.
@@ -295,89 +477,119 @@ static u_int32_t strtoul(const char *nptr, char **endptr, int base) {
  * PART II - List management          *
  **************************************/
 
-static int optimize(void);
+struct addrrange {
+  u_int32_t low;
+  u_int32_t high;
+};
+
+static struct addrrange *arl;
+static size_t arl_len = 0, arl_size = 0;
+
+static int covertoaml(u_int32_t low, u_int32_t high, u_int32_t min, u_int32_t max);
 
 /* addtoaml takes an address and mask
  * and adds it to the list
- * note: it's a little bigger than it needs to be,
- * but it's very modest about memory use
- * and efficient enough considering it's use in optimize() */
+ * note: entries are only collected here, overlaps and
+ * neighbours are resolved all at once by aggregate() */
 int addtoaml(u_int32_t addr, u_int32_t mask) {
-  int neta = addr & mask;
-  char first = 0;
-  struct addrmask *cur = aml, *lst = NULL,
-                  *src = NULL, *dst = NULL, *old = NULL;
-
-  if(aml == NULL || aml->mask > mask ||
-    (aml->mask == mask && aml->neta > neta)) first = 1;
-  else {
-    for(cur = aml; cur && (cur->mask < mask ||
-      (cur->mask == mask && cur->neta <= neta)); lst = cur, cur = cur->next)
-      if(cur->neta == (neta & cur->mask)) {
-        status("skip %08x/%08x (%08x/%08x exists)",
-          neta, mask, cur->neta, cur->mask);
-        return(0);
-      }
-    dst = lst;
+  u_int32_t neta = addr & mask;
+
+  return(addtoarl(neta, neta | ~mask));
+}
+
+/* addtoarl appends a raw address range to the collection array */
+static int addtoarl(u_int32_t low, u_int32_t high) {
+  if(arl_len >= arl_size) {
+    arl_size = arl_size ? arl_size * 2 : 1024;
+    if((arl = (struct addrrange *)realloc(arl,
+      sizeof(struct addrrange) * arl_size)) == NULL) panic("malloc failure");
   }
-  while(cur) {
-    if(neta == (cur->neta & mask)) {
-      status("pull %08x/%08x (%08x/%08x added)",
-        cur->neta, cur->mask, neta, mask);
-      old = cur;
-      cur = cur->next;
-      if(old->prev) old->prev->next = old->next;
-      if(old->next) old->next->prev = old->prev;
-      if(aml == old) aml = cur; // suggested by Erik Gavert <erik@jsdata.se>
-      if(!old->prev && !old->next) {
-        aml = cur = NULL;
-        first = 1;
-      }
-      if(!src) src = old;
-      else free(old);
-    } else cur = cur->next;
+  status("add %08x-%08x", low, high);
+  arl[arl_len].low = low;
+  arl[arl_len].high = high;
+  arl_len++;
+  return(0);
+}
+
+static int arlcmp(const void *a, const void *b) {
+  const struct addrrange *ra = a, *rb = b;
+
+  if(ra->low != rb->low) return(ra->low < rb->low ? -1 : 1);
+  if(ra->high != rb->high) return(ra->high < rb->high ? -1 : 1);
+  return(0);
+}
+
+/* aggregate - sorts the collected ranges once, joins the ones that
+ * overlap or touch, and turns each joined range into its minimal
+ * list of address/mask pairs, none larger than the min mask
+ * with the merge policy, ranges are widened to max mask boundaries
+ * as they are joined; otherwise blocks smaller than max are dropped */
+int aggregate(u_int32_t min, u_int32_t max, policy_t policy) {
+  size_t ri, wi;
+  double t;
+
+  stats.ranges_in = arl_len;
+  if(arl_len == 0) return(0);
+  t = now();
+  qsort(arl, arl_len, sizeof(struct addrrange), &arlcmp);
+  stats.t[PH_SORT] = now() - t;
+  t = now();
+  if(policy == POL_MERGE) {
+    /* widening keeps the array ordered by low address */
+    arl[0].low &= max;
+    arl[0].high |= ~max;
   }
-  if(!src && (src = (struct addrmask *)malloc(sizeof(struct addrmask)))
-    == NULL) panic("malloc failure");
-  src->neta = neta;
-  src->mask = mask;
-  if(first) {
-    status("add first                   {%08x/%08x}%08x/%08x",
-      neta, mask, aml?aml->neta:0, aml?aml->mask:0);
-    src->prev = NULL;
-    src->next = aml;
-    if(aml) aml->prev = src;
-    aml = src;
-  } else if(dst) {
-    status("add middle %08x/%08x{%08x/%08x}%08x/%08x",
-      dst->neta, dst->mask,
-      neta, mask,
-      dst->next?dst->next->neta:0, dst->next?dst->next->mask:0);
-    src->prev = dst;
-    src->next = dst->next;
-    dst->next = src;
-    if(src->next) src->next->prev = src;
-  } else {
-    status("add last   %08x/%08x{%08x/%08x}",
-      lst->neta, lst->mask, neta, mask);
-    src->prev = lst;
-    src->next = NULL;
-    lst->next = src;
+  for(wi = 0, ri = 1; ri < arl_len; ri++) {
+    if(arl[wi].high == 0xffffffff) break;
+    if(policy == POL_MERGE) {
+      arl[ri].low &= max;
+      arl[ri].high |= ~max;
+    }
+    if(arl[ri].low <= arl[wi].high + 1) {
+      status("join %08x-%08x %08x-%08x",
+        arl[wi].low, arl[wi].high, arl[ri].low, arl[ri].high);
+      if(arl[ri].high > arl[wi].high) arl[wi].high = arl[ri].high;
+    } else arl[++wi] = arl[ri];
   }
-  while(optimize());
+  arl_len = wi + 1;
+  stats.ranges_merged = arl_len;
+  for(ri = 0; ri < arl_len; ri++) covertoaml(arl[ri].low, arl[ri].high, min, max);
+  stats.t[PH_MERGE] = now() - t;
+  free(arl);
+  arl = NULL;
+  arl_len = arl_size = 0;
   return(0);
 }
 
-/* optimize - joins two AMs that can be expressed by a larger mask. */
-static int optimize(void) {
-  struct addrmask *cur;
-
-  for(cur = aml; cur->next; cur = cur->next)
-    if(cur->mask == cur->next->mask &&
-      cur->neta == (cur->next->neta & (cur->mask << 1))) {
-      addtoaml(cur->neta, cur->mask << 1);
-      return(1);
+/* covertoaml appends the largest aligned blocks between low and high,
+ * but no larger than the min mask, to the end of the aml, so the array
+ * stays ordered by address; blocks smaller than the max mask are skipped */
+static int covertoaml(u_int32_t low, u_int32_t high, u_int32_t min, u_int32_t max) {
+  u_int64_t size;
+
+  for(;;) {
+    size = low ? (low & -low) : (u_int64_t)1 << 32;
+    if(size > (u_int64_t)~min + 1) size = (u_int64_t)~min + 1;
+    while((u_int64_t)low + size - 1 > high) size >>= 1;
+    if(size < (u_int64_t)~max + 1) {
+      status("drop %08x/%08x", low, ~(u_int32_t)(size - 1));
+      stats.dropped++;
+      goto next;
     }
+    if(aml_len >= aml_size) {
+      aml_size = aml_size ? aml_size * 2 : 1024;
+      if((aml = (struct addrmask *)realloc(aml,
+        sizeof(struct addrmask) * aml_size)) == NULL) panic("malloc failure");
+    }
+    aml[aml_len].neta = low;
+    aml[aml_len].mask = ~(u_int32_t)(size - 1);
+    aml_len++;
+    stats.hist[32 - __builtin_ctzll(size)]++;
+    stats.addresses += size;
+   next:
+    if((u_int64_t)low + size - 1 >= high) break;
+    low += size;
+  }
   return(0);
 }
 
@@ -385,6 +597,11 @@ static int optimize(void) {
  * PART III - Output formatting       *
  **************************************/
 
+static void outflush(void);
+static void outstr(const char *, size_t);
+static void outaddr(u_int32_t, int);
+static void outnum(u_int32_t, int, int, int);
+
 static int dispcidr(struct addrmask *);
 static int dispstd(struct addrmask *);
 static int dispcisco(struct addrmask *);
@@ -393,11 +610,14 @@ static int disphex(struct addrmask *);
 static int dispoctal(struct addrmask *);
 static int dispbinary(struct addrmask *);
 
+static char outbuf[65536];
+static size_t outlen = 0;
+
 /* display - shows the aml in a format specified by style
- * it destroys the list as it sorts */
+ * the aml is already ordered by aggregate(), so it is walked once */
 int display(output_t style) {
-  struct addrmask *am, *list;
   int (*disp)(struct addrmask *) = NULL;
+  size_t i;
 
   switch(style) {
     case OUT_STD:    disp = &dispstd;    break;
@@ -409,74 +629,129 @@ int display(output_t style) {
     case OUT_BINARY: disp = &dispbinary; break;
     default: panic("memfrob() apparently called on code segment");
   }
-  while(aml) {
-    am = NULL;
-    for(list = aml; list; list = list->next)
-      if(!am || am->neta > list->neta) am = list;
-    if(am->next) am->next->prev = am->prev;
-    if(am->prev) am->prev->next = am->next;
-    else aml = am->next;
-    disp(am);
-    free(am);
-  }
+  for(i = 0; i < aml_len; i++) disp(&aml[i]);
+  outflush();
+  free(aml);
+  aml = NULL;
+  aml_len = aml_size = 0;
   return(0);
 }
 
+/* the formatters below append to outbuf, which is written out
+ * whenever it fills up and once more at the end of display() */
+static void outflush(void) {
+  if(outlen && fwrite(outbuf, 1, outlen, stdout) != outlen)
+    panic("write failure");
+  outlen = 0;
+}
+static void outstr(const char *str, size_t len) {
+  if(outlen + len > sizeof(outbuf)) outflush();
+  memcpy(outbuf + outlen, str, len);
+  outlen += len;
+}
+/* outaddr - dotted quad, right aligned to width if positive
+ * or left aligned to -width if negative */
+static void outaddr(u_int32_t addr, int width) {
+  char buf[16], *p = buf;
+  int i, len, pad;
+  u_int32_t b;
+
+  for(i = 24; i >= 0; i -= 8) {
+    b = (addr >> i) & 0xff;
+    if(b >= 100) *p++ = '0' + b / 100;
+    if(b >= 10) *p++ = '0' + b / 10 % 10;
+    *p++ = '0' + b % 10;
+    *p++ = '.';
+  }
+  len = p - buf - 1;
+  pad = (width < 0 ? -width : width) - len;
+  if(width > 0) while(pad-- > 0) outstr(" ", 1);
+  outstr(buf, len);
+  if(width < 0) while(pad-- > 0) outstr(" ", 1);
+}
+/* outnum - unsigned number in the given base, right aligned
+ * to width with fill (like printf's %<width>[oux]) */
+static void outnum(u_int32_t num, int base, int width, int fill) {
+  char buf[32], *p = buf + sizeof(buf);
+  int len;
+
+  do {
+    *--p = "0123456789abcdef"[num % base];
+    num /= base;
+  } while(num);
+  for(len = buf + sizeof(buf) - p; len < width; len++) *--p = fill;
+  outstr(p, buf + sizeof(buf) - p);
+}
+
 static int dispcidr(struct addrmask *am) {
   u_int32_t mask;
   int ctr = 0;
 
   for(mask = am->mask; mask; mask <<= 1) ctr++;
-  printf("%15s/%d\n", inet_ntoa((struct in_addr){htonl(am->neta)}), ctr);
+  outaddr(am->neta, 15);
+  outstr("/", 1);
+  outnum(ctr, 10, 0, ' ');
+  outstr("\n", 1);
   return(0);
 }
 static int dispstd(struct addrmask *am) {
-  char buf[32];
-
-  sprintf(buf,      "%15s/", inet_ntoa((struct in_addr){htonl(am->neta)}));
-  sprintf(buf + 16, "%-15s", inet_ntoa((struct in_addr){htonl(am->mask)}));
-  puts(buf);
+  outaddr(am->neta, 15);
+  outstr("/", 1);
+  outaddr(am->mask, -15);
+  outstr("\n", 1);
   return(0);
 }
 static int dispcisco(struct addrmask *am) {
-  char buf[32];
-
-  sprintf(buf,      "%15s ", inet_ntoa((struct in_addr){htonl(am->neta)}));
-  sprintf(buf + 16, "%-15s", inet_ntoa((struct in_addr){htonl(~am->mask)}));
-  puts(buf);
+  outaddr(am->neta, 15);
+  outstr(" ", 1);
+  outaddr(~am->mask, -15);
+  outstr("\n", 1);
   return(0);
 }
 static int disprange(struct addrmask *am) {
-  char buf[80];
   u_int32_t range = ~am->mask + 1;
 
-  sprintf(buf,      "%15s-", inet_ntoa((struct in_addr){htonl(am->neta)}));
-  sprintf(buf + 16, "%-15s (%u)",
-    inet_ntoa((struct in_addr){htonl(am->neta + range - 1)}), range);
-  puts(buf);
+  outaddr(am->neta, 15);
+  outstr("-", 1);
+  outaddr(am->neta + range - 1, -15);
+  outstr(" (", 2);
+  outnum(range, 10, 0, ' ');
+  outstr(")\n", 2);
   return(0);
 }
 static int disphex(struct addrmask *am) {
-  printf("0x%08x/0x%08x\n", am->neta, am->mask);
+  outstr("0x", 2);
+  outnum(am->neta, 16, 8, '0');
+  outstr("/0x", 3);
+  outnum(am->mask, 16, 8, '0');
+  outstr("\n", 1);
   return(0);
 }
 static int dispoctal(struct addrmask *am) {
-  printf("0%10o/0%10o\n", am->neta, am->mask);
+  outstr("0", 1);
+  outnum(am->neta, 8, 10, ' ');
+  outstr("/0", 2);
+  outnum(am->mask, 8, 10, ' ');
+  outstr("\n", 1);
   return(0);
 }
 static int dispbinary(struct addrmask *am) {
-  char abuf[36], mbuf[36];
+  char buf[74];
+  u_int32_t neta = am->neta, mask = am->mask;
   int  i, j;
 
   for(i = 0; i < 32; i++) {
     j = 34 - (int)(i * 9 / 8);  /* array index skips every 9th element */
-    abuf[j] = am->neta & 1 ? '1' : '0';
-    mbuf[j] = am->mask & 1 ? '1' : '0';
-    am->neta >>= 1;
-    am->mask >>= 1;
+    buf[j] = neta & 1 ? '1' : '0';
+    buf[j + 38] = mask & 1 ? '1' : '0';
+    neta >>= 1;
+    mask >>= 1;
   }
-  abuf[8]  = abuf[17] = abuf[26] = mbuf[8] = mbuf[17] = mbuf[26] = ' ';
-  abuf[35] = mbuf[35] = '\0';
-  printf("%s / %s\n", abuf, mbuf);
+  buf[8]  = buf[17] = buf[26] = buf[46] = buf[55] = buf[64] = ' ';
+  buf[35] = ' ';
+  buf[36] = '/';
+  buf[37] = ' ';
+  buf[73] = '\n';
+  outstr(buf, sizeof(buf));
   return(0);
 }
@@ -173,16 +173,34 @@ start()
 	if [ -n "$safe_dns" ]; then
 		iptables -w -t mangle -A minivtun_go -d $safe_dns -p udp --dport $safe_dns_port \
 			-j MARK --set-mark $VPN_ROUTE_FWMARK
+		iptables -w -t mangle -A minivtun_go -d $safe_dns -p tcp --dport $safe_dns_port \
+			-j MARK --set-mark $VPN_ROUTE_FWMARK
 	fi
 	iptables -w -t mangle -A minivtun_go -m mark --mark $VPN_ROUTE_FWMARK -j ACCEPT  # stop further matches
 
 	iptables -w -t mangle -I PREROUTING -j minivtun_go
 	iptables -w -t mangle -I OUTPUT -p udp --dport 53 -j minivtun_go  # DNS queries over tunnel
+	iptables -w -t mangle -I OUTPUT -p tcp --dport 53 -j minivtun_go  # and retries of truncated ones
 
 	# -----------------------------------------------------------
 	mkdir -p /var/etc/dnsmasq-go.d
+	###### DNS splitting forwarder, instead of per-domain dnsmasq rules ######
+	# It answers over UDP and TCP, and follows the ISP servers in resolv.conf.auto
+	if [ -n "$safe_dns" ] && which dns-forwarder >/dev/null 2>&1 &&
+		domain-merger -o snapshot /etc/gfwlist/china-banned \
+			`ls /etc/gfwlist/china-banned.* 2>/dev/null` > /var/etc/china-banned.dsm; then
+		local set_opt=
+		[ "$proxy_mode" = M ] && set_opt="-i dns-resolved"
+		if dns-forwarder -d -p /var/run/dns-forwarder.pid -f /var/etc/china-banned.dsm \
+			-s "$safe_dns#$safe_dns_port" -r /tmp/resolv.conf.auto -l 127.0.0.1#5353 $set_opt; then
+			printf 'no-resolv\nserver=127.0.0.1#5353\n' > /var/etc/dnsmasq-go.d/00-forwarder.conf
+		fi
+	fi
+
 	###### Anti-pollution configuration ######
-	if [ -n "$safe_dns" ]; then
+	if [ -f /var/etc/dnsmasq-go.d/00-forwarder.conf ]; then
+		:
+	elif [ -n "$safe_dns" ]; then
 		( cat /etc/gfwlist/china-banned; cat /etc/gfwlist/china-banned.* 2>/dev/null; ) | \
 			awk -vs="$safe_dns#$safe_dns_port" '!/^$/&&!/^#/{printf("server=/%s/%s\n",$0,s)}' \
 			> /var/etc/dnsmasq-go.d/01-pollution.conf
@@ -191,6 +209,7 @@ start()
 	fi
 
 	###### dnsmasq-to-ipset configuration ######
+	[ -f /var/etc/dnsmasq-go.d/00-forwarder.conf ] ||
 	case "$proxy_mode" in
 		M)
 			( cat /etc/gfwlist/china-banned; cat /etc/gfwlist/china-banned.* 2>/dev/null; ) | \
@@ -244,6 +263,11 @@ EOF
 stop()
 {
 	# -----------------------------------------------------------
+	if [ -f /var/run/dns-forwarder.pid ]; then
+		kill `cat /var/run/dns-forwarder.pid` 2>/dev/null
+		rm -f /var/run/dns-forwarder.pid
+	fi
+	rm -f /var/etc/china-banned.dsm
 	rm -rf /var/etc/dnsmasq-go.d
 	if [ -f /tmp/dnsmasq.d/dnsmasq-go.conf ]; then
 		rm -f /tmp/dnsmasq.d/dnsmasq-go.conf
@@ -253,6 +277,7 @@ stop()
 	# -----------------------------------------------------------
 	if iptables -w -t mangle -F minivtun_go 2>/dev/null; then
 		while iptables -w -t mangle -D OUTPUT -p udp --dport 53 -j minivtun_go 2>/dev/null; do :; done
+		while iptables -w -t mangle -D OUTPUT -p tcp --dport 53 -j minivtun_go 2>/dev/null; do :; done
 		while iptables -w -t mangle -D PREROUTING -j minivtun_go 2>/dev/null; do :; done
 		iptables -w -t mangle -X minivtun_go 2>/dev/null
 	fi